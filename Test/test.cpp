@@ -6,9 +6,13 @@
 //
 
 #define _USE_MATH_DEFINES
+#ifdef APL_ALLOCATION_TRIPWIRE
+#define APL_ALLOCATION_TRIPWIRE_IMPLEMENTATION
+#endif
 #include <applaudio/applaudio.h>
 #include <cmath>
 #include <iostream>
+#include <random>
 
 //#define USE_INT16_SAMPLES
 
@@ -438,8 +442,849 @@ int test_4()
   return EXIT_SUCCESS;
 }
 
+// Build with -DAPL_ALLOCATION_TRIPWIRE and run with --alloc-tripwire.
+//   Silent (no audio device needed), so it can run in CI.
+int test_alloc_tripwire()
+{
+  std::cout << "=== Test : Allocation Tripwire ===" << std::endl;
+
+  applaudio::AudioEngine engine(false);
+  applaudio::StartupOptions options;
+  options.num_mix_threads = 2;
+  options.parallel_mix_min_voices = 32;
+  options.resample_cache_budget_bytes = 1 << 20;
+  if (!engine.startup(44100, 2, false, true, options))
+  {
+    std::cerr << "Failed to start AudioEngine\n";
+    return EXIT_FAILURE;
+  }
+
+  const int buf_Fs = 22'050;
+  std::vector<float> pcm_mono(buf_Fs / 2);
+  std::vector<float> pcm_stereo(2 * buf_Fs / 2);
+  for (size_t i = 0; i < pcm_mono.size(); ++i)
+  {
+    pcm_mono[i] = 0.2f * static_cast<float>(std::sin(2.0 * M_PI * 440.0 * i / buf_Fs));
+    pcm_stereo[2 * i] = pcm_stereo[2 * i + 1] = pcm_mono[i];
+  }
+  unsigned int buf_mono = engine.create_buffer();
+  engine.set_buffer_data_32f(buf_mono, pcm_mono, 1, buf_Fs);
+  unsigned int buf_stereo = engine.create_buffer();
+  engine.set_buffer_data_32f(buf_stereo, pcm_stereo, 2, buf_Fs);
+
+  engine.init_3d_scene();
+  engine.set_3d_update_interval(2);
+  engine.set_3d_update_budget(32);
+  engine.set_3d_lod_thresholds(0.05f, 0.01f);
+  engine.set_3d_cluster_angle(0.2f);
+  if (engine.num_output_channels() == 2)
+    engine.set_listener_3d_state(la::Mtx4_Identity, la::Vec3_Zero, la::Vec3_Zero, { { -0.12f, 0.05f, -0.05f }, { 0.12f, 0.05f, -0.05f } });
+  else
+    engine.set_listener_3d_state(la::Mtx4_Identity, la::Vec3_Zero, la::Vec3_Zero, { la::Vec3_Zero });
+
+  // Churn sources and parameters while the mix thread runs.
+  std::vector<unsigned int> src_ids;
+  for (int i = 0; i < 200; ++i)
+  {
+    const bool stereo = i % 2 == 1;
+    unsigned int src_id = engine.create_source();
+    engine.attach_buffer_to_source(src_id, stereo ? buf_stereo : buf_mono);
+    engine.set_source_looping(src_id, i % 3 != 0);
+    engine.set_source_pitch(src_id, i % 5 == 0 ? 1.f : 0.5f + 0.01f * (i % 100)); // Pitch 1 plays the cached copy.
+    engine.set_source_gain(src_id, 0.01f);
+    engine.set_source_priority(src_id, 1.f + (i % 7));
+    if (i % 4 == 0)
+      engine.set_source_resampler_quality(src_id, static_cast<applaudio::ResamplerQuality>(i / 4 % 5));
+    if (i % 3 == 0)
+    {
+      engine.enable_source_3d_audio(src_id, true);
+      la::Mtx4 trf_s = la::look_at({ 0.1f * i, 1.f, -2.f }, { 0.f, 0.f, 0.f }, { 0.f, 1.f, 0.f });
+      if (stereo)
+        engine.set_source_3d_state(src_id, trf_s, la::Vec3_Zero, la::Vec3_Zero, { { -1.f, 0.f, 0.f }, { 1.f, 0.f, 0.f } });
+      else
+        engine.set_source_3d_state(src_id, trf_s, la::Vec3_Zero, la::Vec3_Zero, { la::Vec3_Zero });
+      engine.set_source_speed_of_sound(src_id, 343.f);
+      if (i % 6 == 0)
+        engine.set_source_audible_radius(src_id, 8.f); // Those beyond i = 80 or so are out of range.
+      else if (i % 6 == 1)
+        engine.set_source_clusterable(src_id, true);
+    }
+    engine.play_source(src_id);
+    src_ids.emplace_back(src_id);
+    if (i % 10 == 9)
+    {
+      engine.destroy_source(src_ids.front());
+      src_ids.erase(src_ids.begin());
+    }
+    if (i == 100)
+      engine.set_output_stage(applaudio::OutputStageType::Limiter);
+    if (i == 150)
+      engine.set_resampler_quality(applaudio::ResamplerQuality::Sinc16);
+    if (i == 160)
+      engine.set_max_real_voices(48); // Most of the remaining voices go virtual and come back as others end.
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  engine.shutdown();
+
+  auto num_violations = applaudio::alloc_tripwire::num_violations();
+  std::cout << "Allocations on the mix thread: " << num_violations << std::endl;
+#ifndef APL_ALLOCATION_TRIPWIRE
+  std::cout << "(Tripwire not compiled in. Build with -DAPL_ALLOCATION_TRIPWIRE.)" << std::endl;
+#endif
+  return num_violations == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Counts the failed checks of a unit test. Only the first few failures are printed.
+struct Checker
+{
+  static constexpr int c_max_printed = 10;
+  int num_failures = 0;
+  
+  void operator()(bool ok, const char* what)
+  {
+    if (ok)
+      return;
+    if (num_failures < c_max_printed)
+      std::cerr << "FAILED: " << what << std::endl;
+    ++num_failures;
+  }
+  
+  int result() const
+  {
+    std::cout << "Failures: " << num_failures << std::endl;
+    return num_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+};
+
+// Compares SpatialGrid::query() against a brute force search while items are inserted,
+//   moved and removed, including spheres too large for the cells and cell size changes.
+int test_spatial_grid()
+{
+  std::cout << "=== Test : Spatial Grid ===" << std::endl;
+
+  struct Sphere
+  {
+    la::Vec3 center;
+    float radius = 0.f;
+    bool listed = false;
+  };
+  const int num_items = 300;
+  std::vector<Sphere> spheres(num_items);
+  applaudio::a3d::SpatialGrid grid;
+  grid.reserve(num_items / 2); // Also exercise growing past the reservation.
+  grid.set_cell_size(4.f);
+
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> pos(-60.f, 60.f);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  std::uniform_int_distribution<int> pick(0, num_items - 1);
+  auto random_radius = [&]()
+  {
+    const float r = unit(rng);
+    if (r < 0.02f)
+      return 1e12f;
+    if (r < 0.1f)
+      return 0.f;
+    if (r < 0.2f)
+      return 30.f * unit(rng);
+    return 3.f * unit(rng);
+  };
+
+  Checker check;
+  std::vector<int> num_reported(num_items);
+  for (int step = 0; step < 4000; ++step)
+  {
+    const int item = pick(rng);
+    auto& sph = spheres[item];
+    if (sph.listed && unit(rng) < 0.3f)
+    {
+      grid.remove(item);
+      sph.listed = false;
+    }
+    else
+    {
+      // Small moves mostly stay within the same cells.
+      if (sph.listed && unit(rng) < 0.5f)
+        sph.center += la::Vec3 { unit(rng) - 0.5f, unit(rng) - 0.5f, unit(rng) - 0.5f };
+      else
+        sph.center = { pos(rng), pos(rng), pos(rng) };
+      if (!sph.listed || unit(rng) < 0.2f)
+        sph.radius = random_radius();
+      grid.update(item, sph.center, sph.radius);
+      sph.listed = true;
+    }
+    if (step % 500 == 499)
+      grid.set_cell_size(step % 1000 == 499 ? 0.5f : 16.f);
+
+    if (step % 10 != 0)
+      continue;
+    const la::Vec3 center { pos(rng), pos(rng), pos(rng) };
+    const float extent = unit(rng) < 0.05f ? 1e12f : 20.f * unit(rng);
+    std::fill(num_reported.begin(), num_reported.end(), 0);
+    grid.query(center, extent, [&](uint32_t i) { ++num_reported[i]; });
+    for (int i = 0; i < num_items; ++i)
+    {
+      const float reach = spheres[i].radius + extent;
+      const bool expected = spheres[i].listed && (spheres[i].center - center).length_squared() <= reach * reach;
+      check(num_reported[i] == (expected ? 1 : 0), "query reports each item in reach once");
+      check(grid.hit_by_last_query(i) == expected, "hit_by_last_query() agrees with the query");
+    }
+  }
+  size_t num_listed = 0;
+  for (const auto& sph : spheres)
+    num_listed += sph.listed ? 1 : 0;
+  check(grid.size() == num_listed, "size");
+
+  return check.result();
+}
+
+// Tones above full scale through the limiter. process() leaves the limited signal in the bus
+//   before clamping it into the output, so no bus sample may exceed full scale. The falling
+//   half-cycles of the bass tone are where a short sliding minimum would lose its head.
+int test_limiter()
+{
+  std::cout << "=== Test : Limiter ===" << std::endl;
+
+  Checker check;
+  const float full_scale = APL_SHORT_LIMIT_F / APL_SAMPLE_SCALE;
+  const int sample_rate = 44100;
+  const int num_frames = 512;
+  for (auto [amplitude, freq, num_channels] : { std::tuple { 3.f, 60.f, 2 }, { 2.f, 1000.f, 1 }, { 10.f, 200.f, 2 } })
+  {
+    applaudio::OutputStage stage;
+    stage.reset(num_channels, sample_rate);
+    stage.set_type(applaudio::OutputStageType::Limiter);
+    std::vector<float> bus(static_cast<size_t>(num_frames) * num_channels);
+    std::vector<APL_SAMPLE_TYPE> out(bus.size());
+    float peak = 0.f;
+    size_t n = 0;
+    for (int block = 0; block < 100; ++block)
+    {
+      for (int f = 0; f < num_frames; ++f, ++n)
+        for (int c = 0; c < num_channels; ++c)
+          bus[f * num_channels + c] = amplitude * full_scale * static_cast<float>(std::sin(2.0 * M_PI * freq * n / sample_rate));
+      stage.process(bus.data(), num_frames, out.data());
+      for (float x : bus)
+      {
+        check(std::abs(x) <= full_scale * (1.f + 1e-6f), "limited sample within full scale");
+        peak = std::max(peak, std::abs(x));
+      }
+    }
+    check(peak > 0.9f * full_scale, "limited tone stays loud");
+  }
+
+  return check.result();
+}
+
+// WorkerPool runs every task exactly once before run() returns, also right after the pool was
+//   stopped and started again, as AudioEngine::shutdown() and startup() do.
+int test_worker_pool()
+{
+  std::cout << "=== Test : Worker Pool ===" << std::endl;
+
+  Checker check;
+  applaudio::WorkerPool pool;
+  const int num_tasks = 64;
+  std::vector<std::atomic<int>> num_runs(num_tasks);
+  for (int cycle = 0; cycle < 100; ++cycle)
+  {
+    pool.start(3);
+    for (int r = 0; r < 3; ++r)
+    {
+      for (auto& n : num_runs)
+        n.store(0);
+      std::atomic<int> num_bad_threads { 0 };
+      pool.run(num_tasks, [&](int i, int thread_idx)
+      {
+        if (thread_idx < 0 || thread_idx >= pool.num_threads())
+          ++num_bad_threads;
+        volatile float x = 0.f; // Keep the workers busy long enough to overlap.
+        for (int k = 0; k < 2000; ++k)
+          x = x + 1.f;
+        num_runs[i].fetch_add(1);
+      });
+      check(std::all_of(num_runs.begin(), num_runs.end(), [](const auto& n) { return n.load() == 1; }),
+            "every task ran once before run() returned");
+      check(num_bad_threads == 0, "thread indices");
+    }
+    if (cycle % 2 == 0)
+      pool.stop();
+  }
+  pool.stop();
+  check(pool.num_threads() == 1, "no workers after stop()");
+
+  return check.result();
+}
+
+// Single threaded boundary cases of RingBuffer, then a producer and a consumer thread passing
+//   a counting sequence through it in odd sized chunks, so that transfers wrap at every offset.
+int test_ring_buffer()
+{
+  std::cout << "=== Test : Ring Buffer ===" << std::endl;
+
+  Checker check;
+
+  applaudio::RingBuffer<float> ring;
+  check(ring.capacity_frames() == 0, "capacity before reset");
+  for (auto [min_frames, capacity] : { std::pair<size_t, size_t> { 0, 1 }, { 1, 1 }, { 5, 8 }, { 8, 8 }, { 9, 16 }, { 1000, 1024 } })
+  {
+    ring.reset(min_frames, 2);
+    check(ring.capacity_frames() == capacity, "reset rounds up to a power of two");
+  }
+
+  // Capacity 8 frames of 2 channels.
+  ring.reset(8, 2);
+  std::vector<float> in(2 * 16), out(2 * 16);
+  std::iota(in.begin(), in.end(), 0.f);
+  const float* seg = nullptr;
+  check(ring.available_read() == 0 && ring.available_write() == 8, "empty after reset");
+  check(ring.read(out.data(), 4) == 0, "read when empty");
+  check(ring.peek(seg, 4) == 0, "peek when empty");
+  check(ring.write(in.data(), 16) == 8, "write is cut at capacity");
+  check(ring.available_read() == 8 && ring.available_write() == 0, "full");
+  check(ring.write(in.data(), 1) == 0, "write when full");
+  check(ring.read(out.data(), 5) == 5 && std::equal(out.begin(), out.begin() + 10, in.begin()), "read from full");
+
+  // Frames 5 to 7 are left in the last 3 slots, and frames 8 to 12 go to the first 5.
+  check(ring.write(in.data() + 2 * 8, 5) == 5, "write after the end");
+  check(ring.available_read() == 8, "full again");
+  check(ring.peek(seg, 8) == 3 && std::equal(seg, seg + 6, in.begin() + 10), "peek stops at the end of the storage");
+  ring.consume(3);
+  check(ring.peek(seg, 2) == 2 && std::equal(seg, seg + 4, in.begin() + 16), "peek after wrapping");
+  ring.consume(2);
+  check(ring.read(out.data(), 16) == 3 && std::equal(out.begin(), out.begin() + 6, in.begin() + 20), "read the rest");
+  check(ring.available_read() == 0 && ring.available_write() == 8, "empty again");
+
+  // Two segment reads and writes at every offset.
+  for (size_t offset = 0; offset < 8; ++offset)
+  {
+    ring.reset(8, 2);
+    ring.write(in.data(), offset);
+    ring.read(out.data(), offset);
+    std::fill(out.begin(), out.end(), -1.f);
+    const bool ok = ring.write(in.data(), 7) == 7 && ring.read(out.data(), 7) == 7;
+    check(ok && std::equal(out.begin(), out.begin() + 14, in.begin()), "wrapped transfer");
+  }
+
+  // Threaded.
+  const size_t num_frames = 1 << 18;
+  ring.reset(100, 2);
+  std::thread producer([&]()
+  {
+    std::vector<float> chunk(2 * 37);
+    size_t next = 0;
+    while (next < num_frames)
+    {
+      const size_t n = std::min<size_t>(1 + next % 37, num_frames - next);
+      for (size_t i = 0; i < n; ++i)
+        chunk[2 * i] = chunk[2 * i + 1] = static_cast<float>((next + i) % 65536);
+      const size_t num_written = ring.write(chunk.data(), n);
+      if (num_written == 0)
+        std::this_thread::yield();
+      next += num_written;
+    }
+  });
+  size_t num_read = 0, num_wrong = 0;
+  std::vector<float> chunk(2 * 29);
+  auto verify = [&](const float* data, size_t n)
+  {
+    for (size_t i = 0; i < n; ++i, ++num_read)
+    {
+      const float expected = static_cast<float>(num_read % 65536);
+      if (data[2 * i] != expected || data[2 * i + 1] != expected)
+        ++num_wrong;
+    }
+  };
+  while (num_read < num_frames)
+  {
+    // Alternate between copying reads and zero-copy peeks.
+    size_t n = 0;
+    if (num_read % 2 == 0)
+    {
+      n = ring.read(chunk.data(), 1 + num_read % 29);
+      verify(chunk.data(), n);
+    }
+    else
+    {
+      n = ring.peek(seg, 1 + num_read % 23);
+      verify(seg, n);
+      ring.consume(n);
+    }
+    if (n == 0)
+      std::this_thread::yield();
+  }
+  producer.join();
+  check(num_wrong == 0, "threaded transfer keeps every frame in order");
+  check(ring.available_read() == 0, "threaded transfer drains");
+
+  return check.result();
+}
+
+// CommandQueue ordering, capacity and in-place updates, then several producers coalescing
+//   their latest value into their pending item while the consumer pops concurrently.
+int test_command_queue()
+{
+  std::cout << "=== Test : Command Queue ===" << std::endl;
+
+  Checker check;
+
+  for (auto [requested, capacity] : { std::pair<size_t, size_t> { 0, 2 }, { 3, 4 }, { 8, 8 }, { 9, 16 } })
+    check(applaudio::CommandQueue<int>(requested).capacity() == capacity, "capacity rounds up to a power of two");
+
+  applaudio::CommandQueue<int> queue(4);
+  int item = -1;
+  check(!queue.try_pop(item), "pop when empty");
+  std::vector<uint64_t> tickets;
+  for (int i = 0; i < 4; ++i)
+    tickets.emplace_back(queue.try_push(i).value_or(~0ull));
+  check(tickets == std::vector<uint64_t> { 0, 1, 2, 3 }, "tickets count up");
+  check(!queue.try_push(4).has_value(), "push when full");
+  check(queue.try_update(tickets[2], [](int& pending) { pending = 20; }), "update a pending item");
+  check(queue.try_pop(item) && item == 0, "pop in order");
+  check(!queue.try_update(tickets[0], [](int& pending) { pending = 10; }), "update a popped item");
+  const auto ticket_4 = queue.try_push(4);
+  check(ticket_4.has_value(), "push after a pop");
+  // Ticket 0's cell now holds ticket 4, which the old ticket must not reach.
+  check(!queue.try_update(tickets[0], [](int& pending) { pending = 10; }), "update through a stale ticket");
+  std::vector<int> popped;
+  while (queue.try_pop(item))
+    popped.emplace_back(item);
+  check(popped == std::vector<int> { 1, 20, 3, 4 }, "updated item keeps its place");
+  check(queue.num_pushed() == 5 && queue.num_popped() == 5, "push and pop counts");
+
+  // Threaded. Each producer writes increasing values, rewriting its pending item when it can.
+  struct Value
+  {
+    int producer = 0;
+    int value = 0;
+  };
+  const int num_producers = 3;
+  const int num_values = 20'000;
+  applaudio::CommandQueue<Value> values(64);
+  std::vector<std::thread> producers;
+  for (int p = 0; p < num_producers; ++p)
+    producers.emplace_back([&values, p]()
+    {
+      std::optional<uint64_t> ticket;
+      for (int i = 0; i < num_values; ++i)
+      {
+        const Value v { p, i };
+        if (ticket.has_value() && values.try_update(ticket.value(), [&v](Value& pending) { pending = v; }))
+          continue;
+        while (!(ticket = values.try_push(v)).has_value())
+          std::this_thread::yield();
+      }
+    });
+  std::vector<int> last(num_producers, -1);
+  int num_out_of_order = 0;
+  Value v;
+  while (std::any_of(last.begin(), last.end(), [&](int value) { return value != num_values - 1; }))
+  {
+    if (!values.try_pop(v))
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    if (v.value <= last[v.producer])
+      ++num_out_of_order;
+    last[v.producer] = v.value;
+  }
+  for (auto& producer : producers)
+    producer.join();
+  check(num_out_of_order == 0, "coalesced values arrive in order");
+  check(!values.try_pop(v), "nothing after each producer's last value");
+
+  return check.result();
+}
+
+// SlotMap handles: stale handle rejection, the generation wrap after 2^12 reuses of a slot,
+//   handles shared with a mirror map, and running out of slots.
+int test_slot_map()
+{
+  std::cout << "=== Test : Slot Map ===" << std::endl;
+
+  Checker check;
+
+  using Map = applaudio::SlotMap<int>;
+  Map map;
+  check(map.find(0) == nullptr, "handle 0 is never valid");
+  const uint32_t a = map.insert(1);
+  const uint32_t b = map.insert(2);
+  check(a != 0 && b != 0 && a != b, "distinct nonzero handles");
+  check(map.find(a) != nullptr && *map.find(a) == 1 && *map.find(b) == 2, "find");
+  check(map.find(Map::make_handle(5, 0)) == nullptr, "handle beyond the slots");
+  check(map.erase(a) && map.size() == 1, "erase");
+  check(map.find(a) == nullptr && !map.erase(a), "stale handle after erase");
+  const uint32_t c = map.insert(3);
+  check(Map::index_of(c) == Map::index_of(a) && c != a, "reused slot gets a new handle");
+  check(map.find(a) == nullptr && *map.find(c) == 3, "stale handle doesn't reach the new value");
+
+  // Freed slots are reused in the order they were freed.
+  const uint32_t d = map.insert(4);
+  map.erase(c);
+  map.erase(d);
+  const uint32_t c2 = map.insert(5);
+  const uint32_t d2 = map.insert(6);
+  check(Map::index_of(c2) == Map::index_of(c) && Map::index_of(d2) == Map::index_of(d), "oldest freed slot reused first");
+
+  // Churning one slot: each reuse bumps its generation, and rather than wrapping back to the
+  //   slot's first handle, the slot is retired.
+  const uint32_t num_generations = Map::c_generation_mask + 1;
+  std::vector<uint32_t> handles { c2 };
+  for (uint32_t i = 1; i <= num_generations; ++i)
+  {
+    map.erase(handles.back());
+    handles.emplace_back(map.insert(static_cast<int>(i)));
+  }
+  check(Map::index_of(handles[1]) == Map::index_of(c2), "the freed slot is reused");
+  check(Map::index_of(handles.back()) != Map::index_of(c2), "the slot is retired before its generation wraps");
+  bool stale_found = map.find(a) != nullptr || map.find(c) != nullptr;
+  for (size_t i = 0; i + 1 < handles.size(); ++i)
+    stale_found |= handles[i] == 0 || map.find(handles[i]) != nullptr;
+  check(!stale_found, "old handles stay stale");
+  check(*map.find(handles.back()) == static_cast<int>(num_generations) && map.size() == 3 && *map.find(d2) == 6, "newest value");
+
+  // A mirror map takes the same handles.
+  Map mirror;
+  map.for_each([&](uint32_t handle, int value) { mirror.emplace_at(handle, 10 * value); });
+  check(mirror.size() == map.size() && *mirror.find(b) == 20 && mirror.find(a) == nullptr, "mirror shares handles");
+  mirror.erase(b);
+  mirror.emplace_at(Map::make_handle(Map::index_of(b), Map::generation_of(b) + 1), 30);
+  check(mirror.find(b) == nullptr, "mirror rejects stale handles");
+
+  // Running out of slots.
+  Map full;
+  full.reserve(Map::c_max_slots);
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < Map::c_max_slots; ++i)
+    last = full.insert(0);
+  check(last != 0 && full.insert(0) == 0, "insert returns 0 when full");
+  check(full.erase(last) && full.insert(0) != 0, "a freed slot can be reused when full");
+
+  return check.result();
+}
+
+namespace applaudio
+{
+  // Lets the unit tests render blocks on the calling thread and inspect the mix side state.
+  //   Only valid while the engine isn't running.
+  struct EngineTestAccess
+  {
+    static void render(AudioEngine& engine, std::vector<APL_SAMPLE_TYPE>& out)
+    {
+      out.resize(static_cast<size_t>(engine.m_frame_count) * engine.m_output_channels);
+      engine.render(out.data(), engine.m_frame_count);
+    }
+    static const a3d::ParamTable& params_3d(const AudioEngine& engine) { return engine.m_mix_params_3d; }
+    static uint32_t voice_of(unsigned int src_id) { return AudioEngine::voice_index(src_id); }
+    static bool out_of_range(const AudioEngine& engine, unsigned int src_id)
+    {
+      return engine.m_voices.has(voice_of(src_id), VoiceTable::OutOfRange);
+    }
+    static bool resampled(const AudioEngine& engine, unsigned int src_id)
+    {
+      return engine.m_voices.has(voice_of(src_id), VoiceTable::Resampled);
+    }
+  };
+}
+
+// Renders the same changing 3D scene twice, once with the incremental updates and once with
+//   every 3D voice updated every block, and compares the resulting 3D parameters.
+int test_3d_dirty_tracking()
+{
+  std::cout << "=== Test : 3D Dirty Tracking ===" << std::endl;
+
+  using Access = applaudio::EngineTestAccess;
+  applaudio::AudioEngine engine_inc(false), engine_full(false);
+  std::array<applaudio::AudioEngine*, 2> engines { &engine_inc, &engine_full };
+  for (auto* engine : engines)
+  {
+    if (!engine->startup(44100, 2, false, false))
+    {
+      std::cerr << "Failed to start AudioEngine\n";
+      return EXIT_FAILURE;
+    }
+    engine->shutdown(); // Blocks are rendered by Access::render() below.
+    engine->init_3d_scene();
+  }
+  const bool stereo_listener = engine_inc.num_output_channels() == 2;
+  auto set_listener = [&](applaudio::AudioEngine& engine, const la::Mtx4& trf)
+  {
+    if (stereo_listener)
+      engine.set_listener_3d_state(trf, la::Vec3_Zero, la::Vec3_Zero, { { -0.12f, 0.f, 0.f }, { 0.12f, 0.f, 0.f } });
+    else
+      engine.set_listener_3d_state(trf, la::Vec3_Zero, la::Vec3_Zero, { la::Vec3_Zero });
+  };
+
+  // Apply each change to both engines, so that they get the same ids.
+  auto both = [&](auto&& f) { f(engine_inc); f(engine_full); };
+  const int buf_Fs = 22'050;
+  std::array<unsigned int, 3> buf_ids {};
+  for (int n_ch = 1; n_ch <= 3; ++n_ch)
+    both([&](auto& engine)
+    {
+      buf_ids[n_ch - 1] = engine.create_buffer();
+      engine.set_buffer_data_32f(buf_ids[n_ch - 1], std::vector<float>(n_ch * buf_Fs / 4, 0.1f), n_ch, buf_Fs);
+    });
+  la::Mtx4 trf_listener = la::Mtx4_Identity;
+  both([&](auto& engine) { set_listener(engine, trf_listener); });
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> pos(-15.f, 15.f);
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  std::vector<unsigned int> src_ids;
+  std::vector<int> src_num_channels;
+  auto place = [&](unsigned int src_id, int n_ch)
+  {
+    const la::Mtx4 trf = la::look_at({ pos(rng), pos(rng), pos(rng) }, la::Vec3_Zero, { 0.f, 1.f, 0.f });
+    const la::Vec3 vel { unit(rng), 0.f, unit(rng) };
+    std::vector<la::Vec3> offsets;
+    for (int ch = 0; ch < n_ch; ++ch)
+      offsets.push_back({ 0.5f * ch - 0.5f, 0.f, 0.f });
+    both([&](auto& engine) { engine.set_source_3d_state(src_id, trf, vel, la::Vec3_Zero, offsets); });
+  };
+  auto add_source = [&](int i)
+  {
+    const int n_ch = 1 + i % 3;
+    unsigned int src_id = 0;
+    both([&](auto& engine)
+    {
+      src_id = engine.create_source();
+      engine.attach_buffer_to_source(src_id, buf_ids[n_ch - 1]);
+      engine.set_source_looping(src_id, true);
+      engine.enable_source_3d_audio(src_id, true);
+      engine.set_source_speed_of_sound(src_id, 343.f);
+      if (i % 4 == 0)
+        engine.set_source_audible_radius(src_id, 12.f);
+    });
+    place(src_id, n_ch);
+    both([&](auto& engine) { engine.play_source(src_id); });
+    src_ids.emplace_back(src_id);
+    src_num_channels.emplace_back(n_ch);
+  };
+  for (int i = 0; i < 60; ++i)
+    add_source(i);
+
+  std::vector<APL_SAMPLE_TYPE> out;
+  Checker check;
+  for (int block = 0; block < 120; ++block)
+  {
+    // A few sources change every block, the listener only now and then.
+    for (int k = 0; k < 3; ++k)
+    {
+      const size_t idx = rng() % src_ids.size();
+      const unsigned int src_id = src_ids[idx];
+      switch (rng() % 6)
+      {
+        case 0: place(src_id, src_num_channels[idx]); break;
+        case 1: { const float alpha = unit(rng); both([&](auto& engine) { engine.set_source_directivity_alpha(src_id, alpha); }); } break;
+        case 2: { const float d = 1.f + 10.f * unit(rng); both([&](auto& engine) { engine.set_source_attenuation_max_distance(src_id, d); }); } break;
+        case 3: { const float r = unit(rng); both([&](auto& engine) { engine.set_source_rear_attenuation(src_id, r); }); } break;
+        case 4: both([&](auto& engine) { engine.stop_source(src_id); engine.play_source(src_id); }); break;
+        case 5:
+          both([&](auto& engine) { engine.destroy_source(src_id); });
+          src_ids.erase(src_ids.begin() + idx);
+          src_num_channels.erase(src_num_channels.begin() + idx);
+          add_source(block);
+          break;
+      }
+    }
+    if (block % 25 == 5)
+    {
+      trf_listener = la::look_at({ pos(rng), 0.f, pos(rng) }, la::Vec3_Zero, { 0.f, 1.f, 0.f });
+      both([&](auto& engine) { set_listener(engine, trf_listener); });
+    }
+    else
+      set_listener(engine_full, trf_listener); // Makes every 3D voice update.
+
+    Access::render(engine_inc, out);
+    Access::render(engine_full, out);
+
+    const auto& params_inc = Access::params_3d(engine_inc);
+    const auto& params_full = Access::params_3d(engine_full);
+    for (auto src_id : src_ids)
+    {
+      const uint32_t v = Access::voice_of(src_id);
+      const bool out_of_range = Access::out_of_range(engine_inc, src_id);
+      check(out_of_range == Access::out_of_range(engine_full, src_id), "same voices out of range");
+      if (out_of_range)
+        continue; // Not mixed, so its parameters don't matter.
+      const int num_emitters = params_inc.num_emitters(v);
+      check(num_emitters == params_full.num_emitters(v), "same number of emitters");
+      for (int ch_e = 0; ch_e < std::min(num_emitters, params_full.num_emitters(v)); ++ch_e)
+        for (int ch_l = 0; ch_l < params_inc.num_listener_channels(); ++ch_l)
+        {
+          check(params_inc.gains(v, ch_e)[ch_l] == params_full.gains(v, ch_e)[ch_l], "same gains");
+          check(params_inc.doppler_shifts(v, ch_e)[ch_l] == params_full.doppler_shifts(v, ch_e)[ch_l], "same doppler shifts");
+        }
+    }
+  }
+
+  return check.result();
+}
+
+// Sources at pitch 1 play the buffer's copy at the output rate, one-shot or looping and whether
+//   or not the buffer has a whole number of frames at the output rate. Compared to an engine
+//   without the cache that resamples live with the same sinc.
+int test_resample_cache()
+{
+  std::cout << "=== Test : Resample Cache ===" << std::endl;
+
+  using Access = applaudio::EngineTestAccess;
+  Checker check;
+  applaudio::AudioEngine engine_cached(false), engine_live(false);
+  std::array<applaudio::AudioEngine*, 2> engines { &engine_cached, &engine_live };
+  for (auto* engine : engines)
+  {
+    applaudio::StartupOptions options;
+    options.resample_cache_budget_bytes = engine == &engine_cached ? 1 << 24 : 0;
+    if (!engine->startup(44100, 1, false, false, options))
+    {
+      std::cerr << "Failed to start AudioEngine\n";
+      return EXIT_FAILURE;
+    }
+    engine->shutdown(); // Blocks are rendered by Access::render() below.
+    engine->set_resampler_quality(applaudio::ResamplerQuality::Sinc32);
+  }
+  const float full_scale = APL_SHORT_LIMIT_F / APL_SAMPLE_SCALE;
+  const int out_Fs = engine_cached.output_sample_rate();
+
+  // Half the output rate gives an exact copy, the odd length at 32 kHz doesn't.
+  for (auto [buf_Fs, buf_frames, looping] : { std::tuple { out_Fs / 2, out_Fs / 4, false },
+                                              { 32'000, 32'007, false }, { out_Fs / 2, out_Fs / 4, true },
+                                              { 32'000, 32'007, true } })
+  {
+    std::vector<float> pcm(buf_frames);
+    for (int i = 0; i < buf_frames; ++i)
+      pcm[i] = 0.5f * static_cast<float>(std::sin(2.0 * M_PI * 300.0 * i / buf_Fs));
+    std::array<unsigned int, 2> src_ids {};
+    for (int e = 0; e < 2; ++e)
+    {
+      auto& engine = *engines[e];
+      auto buf_id = engine.create_buffer();
+      engine.set_buffer_data_32f(buf_id, pcm, 1, buf_Fs);
+      src_ids[e] = engine.create_source();
+      engine.attach_buffer_to_source(src_ids[e], buf_id);
+      engine.set_source_looping(src_ids[e], looping);
+      engine.play_source(src_ids[e]);
+    }
+    check(engine_cached.get_resample_cache_size() > 0, "buffer copied at the output rate");
+    
+    // Through the end of the buffer and, when looping, across the loop point twice.
+    const int num_out_frames = static_cast<int>(int64_t { buf_frames } * out_Fs / buf_Fs) * (looping ? 3 : 1) - 1024;
+    std::vector<APL_SAMPLE_TYPE> out_cached, out_live;
+    int num_cached_blocks = 0;
+    double max_diff = 0.0;
+    for (int f = 0; f < num_out_frames; f += static_cast<int>(out_cached.size()))
+    {
+      Access::render(engine_cached, out_cached);
+      Access::render(engine_live, out_live);
+      num_cached_blocks += Access::resampled(engine_cached, src_ids[0]) ? 1 : 0;
+      check(!Access::resampled(engine_live, src_ids[1]), "no copy without a cache budget");
+      for (size_t i = 0; i < out_cached.size(); ++i)
+        max_diff = std::max(max_diff, std::abs(static_cast<double>(out_cached[i]) - out_live[i]));
+    }
+    const int num_blocks = (num_out_frames + static_cast<int>(out_cached.size()) - 1) / static_cast<int>(out_cached.size());
+    check(num_cached_blocks > num_blocks / 2, looping ? "looping source plays the copy" : "one-shot source plays the copy");
+    check(max_diff < 1e-3 * full_scale, "copy sounds like live resampling");
+    
+    for (int e = 0; e < 2; ++e)
+      engines[e]->destroy_source(src_ids[e]);
+  }
+
+  return check.result();
+}
+
+// Run with --unit-tests. Silent and deterministic, so it can run in CI.
+int run_unit_tests()
+{
+  if (test_spatial_grid() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_3d_dirty_tracking() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_ring_buffer() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_command_queue() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_slot_map() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_worker_pool() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_limiter() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (test_resample_cache() == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  return EXIT_SUCCESS;
+}
+
+// Run with --bench-voices. Silent. Plays 1k and 10k sources, a third of them 3D, behind a
+//   64 voice limit, so most of the render time goes to walking the per voice state.
+int bench_voices()
+{
+  std::cout << "=== Benchmark : Voice State ===" << std::endl;
+
+  const int buf_Fs = 22'050;
+  std::vector<float> pcm(buf_Fs);
+  for (size_t i = 0; i < pcm.size(); ++i)
+    pcm[i] = 0.2f * static_cast<float>(std::sin(2.0 * M_PI * 440.0 * i / buf_Fs));
+
+  for (int num_sources : { 1'000, 10'000 })
+  {
+    applaudio::AudioEngine engine(false);
+    applaudio::StartupOptions options;
+    options.max_sources = num_sources;
+    if (!engine.startup(44100, 2, false, false, options))
+    {
+      std::cerr << "Failed to start AudioEngine\n";
+      return EXIT_FAILURE;
+    }
+    engine.set_max_real_voices(64);
+    engine.init_3d_scene();
+    engine.set_listener_3d_state(la::Mtx4_Identity, la::Vec3_Zero, la::Vec3_Zero, { la::Vec3_Zero });
+
+    unsigned int buf_id = engine.create_buffer();
+    engine.set_buffer_data_32f(buf_id, pcm, 1, buf_Fs);
+    for (int i = 0; i < num_sources; ++i)
+    {
+      unsigned int src_id = engine.create_source();
+      engine.attach_buffer_to_source(src_id, buf_id);
+      engine.set_source_looping(src_id, true);
+      engine.set_source_pitch(src_id, 0.5f + 0.001f * (i % 1000));
+      engine.set_source_gain(src_id, 0.001f * (1 + i % 97));
+      if (i % 3 == 0)
+      {
+        engine.enable_source_3d_audio(src_id, true);
+        const float angle = 0.01f * i;
+        la::Mtx4 trf_s = la::look_at({ 20.f * std::cos(angle), 0.f, 20.f * std::sin(angle) }, la::Vec3_Zero, { 0.f, 1.f, 0.f });
+        engine.set_source_3d_state(src_id, trf_s, la::Vec3_Zero, la::Vec3_Zero, { la::Vec3_Zero });
+      }
+      engine.play_source(src_id);
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    auto stats_0 = engine.get_render_stats();
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+    auto stats_1 = engine.get_render_stats();
+    engine.shutdown();
+
+    const double ms_per_block = (stats_1.render_time_ms - stats_0.render_time_ms)
+      / static_cast<double>(std::max<uint64_t>(stats_1.num_blocks - stats_0.num_blocks, 1));
+    std::cout << num_sources << " sources: " << ms_per_block << " ms per block, "
+      << 1e6 * ms_per_block / num_sources << " ns per source" << std::endl;
+  }
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, const char* argv[])
 {
+  if (argc > 1 && std::string(argv[1]) == "--alloc-tripwire")
+    return test_alloc_tripwire();
+  if (argc > 1 && std::string(argv[1]) == "--unit-tests")
+    return run_unit_tests();
+  if (argc > 1 && std::string(argv[1]) == "--bench-voices")
+    return bench_voices();
+
   if (test_1() == EXIT_FAILURE)
     return EXIT_FAILURE;
   if (test_2() == EXIT_FAILURE)
@@ -0,0 +1,47 @@
+//
+//  AlignedBuffer.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  // Fixed size, cache line aligned array. Contents are value initialized on resize().
+  template<typename T, size_t Alignment = 64>
+  class AlignedBuffer
+  {
+    struct Deleter
+    {
+      void operator()(T* ptr) const { ::operator delete[](ptr, std::align_val_t(Alignment)); }
+    };
+
+    std::unique_ptr<T[], Deleter> m_data;
+    size_t m_size = 0;
+
+  public:
+    AlignedBuffer() = default;
+    explicit AlignedBuffer(size_t size) { resize(size); }
+
+    void resize(size_t size)
+    {
+      m_data.reset(static_cast<T*>(::operator new[](std::max<size_t>(size, 1) * sizeof(T), std::align_val_t(Alignment))));
+      m_size = size;
+      std::fill(m_data.get(), m_data.get() + m_size, T {});
+    }
+
+    size_t size() const { return m_size; }
+    T* data() { return m_data.get(); }
+    const T* data() const { return m_data.get(); }
+    T& operator[](size_t i) { return m_data[i]; }
+    const T& operator[](size_t i) const { return m_data[i]; }
+  };
+
+}
@@ -0,0 +1,128 @@
+//
+//  AllocationTripwire.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+
+// Debug aid that reports heap allocations made by the mix thread (and the mix workers).
+//   Define APL_ALLOCATION_TRIPWIRE in every translation unit that includes applaudio, and
+//   additionally APL_ALLOCATION_TRIPWIRE_IMPLEMENTATION in exactly one of them. The latter
+//   replaces the global operator new/delete with versions that check the calling thread.
+//   Without APL_ALLOCATION_TRIPWIRE everything here compiles to nothing.
+#ifdef APL_ALLOCATION_TRIPWIRE
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#endif
+
+namespace applaudio
+{
+
+  namespace alloc_tripwire
+  {
+
+#ifdef APL_ALLOCATION_TRIPWIRE
+    inline thread_local bool t_armed = false;
+    inline std::atomic<size_t> g_num_violations { 0 };
+
+    // Called by the replaced operator new.
+    inline void on_allocation(size_t size)
+    {
+      if (!t_armed)
+        return;
+      if (g_num_violations.fetch_add(1, std::memory_order_relaxed) < 16)
+        std::fprintf(stderr, "ERROR: Heap allocation of %zu bytes on the mix thread!\n", size);
+    }
+
+    // Number of allocations made on an armed thread so far.
+    inline size_t num_violations() { return g_num_violations.load(std::memory_order_relaxed); }
+
+    // Arms the tripwire for the current thread while in scope.
+    class ScopedArm
+    {
+      bool m_prev = false;
+    public:
+      ScopedArm() : m_prev(t_armed) { t_armed = true; }
+      ~ScopedArm() { t_armed = m_prev; }
+      ScopedArm(const ScopedArm&) = delete;
+      ScopedArm& operator=(const ScopedArm&) = delete;
+    };
+#else
+    inline size_t num_violations() { return 0; }
+
+    class ScopedArm
+    {
+    public:
+      ScopedArm() {}
+      ~ScopedArm() {}
+      ScopedArm(const ScopedArm&) = delete;
+      ScopedArm& operator=(const ScopedArm&) = delete;
+    };
+#endif
+
+  }
+
+}
+
+#if defined(APL_ALLOCATION_TRIPWIRE) && defined(APL_ALLOCATION_TRIPWIRE_IMPLEMENTATION)
+#include <new>
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace applaudio
+{
+  namespace alloc_tripwire
+  {
+    inline void* checked_alloc(size_t size, size_t alignment)
+    {
+      on_allocation(size);
+      size = size == 0 ? 1 : size;
+      void* ptr = nullptr;
+      if (alignment <= alignof(std::max_align_t))
+        ptr = std::malloc(size);
+      else
+      {
+#ifdef _WIN32
+        ptr = _aligned_malloc(size, alignment);
+#else
+        ptr = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+      }
+      if (ptr == nullptr)
+        throw std::bad_alloc();
+      return ptr;
+    }
+
+    inline void checked_free(void* ptr, size_t alignment)
+    {
+#ifdef _WIN32
+      if (alignment > alignof(std::max_align_t))
+      {
+        _aligned_free(ptr);
+        return;
+      }
+#endif
+      (void)alignment;
+      std::free(ptr);
+    }
+  }
+}
+
+void* operator new(std::size_t size) { return applaudio::alloc_tripwire::checked_alloc(size, 0); }
+void* operator new[](std::size_t size) { return applaudio::alloc_tripwire::checked_alloc(size, 0); }
+void* operator new(std::size_t size, std::align_val_t al) { return applaudio::alloc_tripwire::checked_alloc(size, static_cast<size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return applaudio::alloc_tripwire::checked_alloc(size, static_cast<size_t>(al)); }
+void operator delete(void* ptr) noexcept { applaudio::alloc_tripwire::checked_free(ptr, 0); }
+void operator delete[](void* ptr) noexcept { applaudio::alloc_tripwire::checked_free(ptr, 0); }
+void operator delete(void* ptr, std::size_t) noexcept { applaudio::alloc_tripwire::checked_free(ptr, 0); }
+void operator delete[](void* ptr, std::size_t) noexcept { applaudio::alloc_tripwire::checked_free(ptr, 0); }
+void operator delete(void* ptr, std::align_val_t al) noexcept { applaudio::alloc_tripwire::checked_free(ptr, static_cast<size_t>(al)); }
+void operator delete[](void* ptr, std::align_val_t al) noexcept { applaudio::alloc_tripwire::checked_free(ptr, static_cast<size_t>(al)); }
+void operator delete(void* ptr, std::size_t, std::align_val_t al) noexcept { applaudio::alloc_tripwire::checked_free(ptr, static_cast<size_t>(al)); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t al) noexcept { applaudio::alloc_tripwire::checked_free(ptr, static_cast<size_t>(al)); }
+#endif
@@ -16,12 +16,26 @@
 #include "Backend_Windows_WASAPI.h"
 #include "System.h"
 #include "PositionalAudio.h"
+#include "Command.h"
+#include "CommandQueue.h"
+#include "AlignedBuffer.h"
+#include "WorkerPool.h"
+#include "MixKernels.h"
+#include "OutputStage.h"
+#include "AllocationTripwire.h"
+#include "SlotMap.h"
+#include "VoiceTable.h"
+#include "SpatialGrid.h"
 #include <memory>
 #include <iostream>
 #include <thread>
+#include <mutex>
 #include <chrono>
 #include <atomic>
 #include <vector>
+#include <array>
+#include <numeric>
+#include <tuple>
 #include <unordered_map>
 #include <cmath>
 
@@ -30,9 +44,13 @@ namespace applaudio
 {
   
   // //////////////
+  
+  struct EngineTestAccess; // Defined by the unit tests in Test/test.cpp.
 
   class AudioEngine
   {
+    friend struct EngineTestAccess;
+    
     std::unique_ptr<IBackend> m_backend;
     
     int m_frame_count = 0;
@@ -40,31 +58,168 @@ namespace applaudio
     int m_output_sample_rate = 0;
     int m_bits = 32;
     
+    // ----- API side state. Guarded by m_state_mutex, never touched by the mix thread. -----
+    
     std::unique_ptr<a3d::PositionalAudio> scene_3d;
     
     Listener listener;
     
-    std::unordered_map<unsigned int, Source> m_sources;
-    std::unordered_map<unsigned int, Buffer> m_buffers;
-    unsigned int m_next_source_id = 1;
-    unsigned int m_next_buffer_id = 1;
+    // Source and buffer ids are SlotMap handles.
+    SlotMap<Source> m_sources;
+    SlotMap<std::unique_ptr<Buffer>> m_buffers;
+    SlotMap<std::unique_ptr<SourceStatus>> m_source_statuses; // Under the source's id.
+    unsigned int m_next_play_id = 1;
+    OutputStageType m_output_stage_type = OutputStageType::HardClip;
+    ResamplerQuality m_resampler_quality = ResamplerQuality::Linear;
+    size_t m_resample_cache_budget = 0; // Bytes. See StartupOptions::resample_cache_budget_bytes.
+    int m_max_real_voices = 0;
+    int m_3d_update_interval = 1;
+    int m_3d_update_budget = 0;
+    float m_lod_reduced_below = 0.f;
+    float m_lod_minimal_below = 0.f;
+    float m_3d_cluster_angle = 0.f;
+    static constexpr float c_min_3d_cluster_angle = 1e-4f; // Keeps the direction cells of a cluster within int32_t.
+    size_t m_resample_cache_bytes = 0;
+    
+    // Tickets of pending coalescable commands.
+    std::unordered_map<uint64_t, uint64_t> m_coalesce_tickets;
+    
+    // Resources the mix thread may still reference. Freed once the command
+    //   with the given ticket has been applied.
+    struct RetiredResource
+    {
+      uint64_t ticket = 0;
+      std::unique_ptr<Buffer> buffer;
+      std::unique_ptr<SourceStatus> status;
+    };
+    std::vector<RetiredResource> m_retired;
+    
+    mutable std::mutex m_state_mutex;
     
+    // ----- Mix side state. Only touched by the thread that drains m_commands. -----
+    
+    a3d::PositionalAudio m_mix_scene_3d;
+    bool m_mix_3d_active = false;
+    int m_mix_3d_update_interval = 1; // In blocks.
+    int m_mix_3d_blocks_since_update = 0;
+    int m_mix_3d_update_budget = 0; // Sources per full update. 0: no limit.
+    // A voice due for new 3D parameters when there are more than m_mix_3d_update_budget.
+    struct UpdateCandidate
+    {
+      float urgency = 0.f;
+      uint32_t voice = 0;
+    };
+    std::vector<UpdateCandidate> m_mix_3d_candidates;
+    static constexpr float c_min_update_importance = 1e-6f; // So that silent voices still age.
+    float m_mix_lod_reduced_below = 0.f;
+    float m_mix_lod_minimal_below = 0.f;
+    static constexpr float c_lod_hysteresis = 1.4f; // About 3 dB.
+    float m_mix_3d_cluster_angle = 0.f; // In radians. 0: no clustering.
+    // A clusterable voice in update_3d_scene(). Voices with equal keys form a cluster.
+    struct ClusterEntry
+    {
+      std::array<int32_t, 7> key {}; // Buffer id, looping, pitch band, direction cell x, y, z, distance band.
+      uint32_t voice = 0;
+      la::Vec3 center;
+      bool operator<(const ClusterEntry& other) const { return std::tie(key, voice) < std::tie(other.key, other.voice); }
+    };
+    std::vector<ClusterEntry> m_mix_cluster_entries;
+    
+    Listener m_mix_listener;
+    bool m_mix_listener_changed = false; // Every 3D voice needs new parameters.
+    ResamplerQuality m_mix_resampler_quality = ResamplerQuality::Linear;
+    int m_mix_max_real_voices = 0; // 0: no limit.
+    
+    // Mirror the API side maps under the same handles. What mixing reads of each source is in
+    //   m_voices, indexed by slot, and the rest in m_mix_sources.
+    SlotMap<Source3D> m_mix_sources;
+    VoiceTable m_voices;
+    a3d::ParamTable m_mix_params_3d; // Written by update_3d_scene(), read while mixing 3D voices.
+    a3d::SpatialGrid m_mix_grid; // 3D voices with an audible radius, by slot.
+    int m_mix_num_out_of_range = 0; // Voices out of range or clustered that the last block skipped outright.
+    SlotMap<const Buffer*> m_mix_buffers;
+    // Ids of the sources that may be playing, in the order they started. Stale entries are
+    //   dropped by mix(), so the cost per block follows the number of playing voices.
+    std::vector<unsigned int> m_mix_playing;
+    
+    // Voices playing in the current block, in a fixed order. They are mixed in chunks of
+    //   c_voices_per_mix_chunk voices, each chunk into its own bus. The chunking only depends
+    //   on the voices, so the summation order is the same no matter how many threads mix.
+    struct ActiveVoice
+    {
+      uint32_t voice = 0; // Index into m_voices.
+      const Buffer* buf = nullptr;
+      float audibility = 0.f;
+      int fade = 0; // See mix_kernels::VoiceBlock::fade.
+    };
+    static constexpr int c_voices_per_mix_chunk = 16;
+    std::vector<ActiveVoice> m_active_voices;
+    // Float buses with headroom. Chunk 0 mixes into m_mix_bus, which the output stage then turns into samples.
+    AlignedBuffer<float> m_mix_bus;
+    std::vector<AlignedBuffer<float>> m_mix_buses;
+    OutputStage m_output_stage;
+    
+    // Per mix thread, so that chunks can be mixed concurrently.
+    struct MixScratch
+    {
+      AlignedBuffer<float> samples; // Resampled source channels, one row per channel.
+      AlignedBuffer<float> gains; // dst_ch x src_ch, row major.
+    };
+    std::vector<MixScratch> m_mix_scratch;
+    WorkerPool m_mix_workers;
+    int m_parallel_mix_min_voices = 0;
+    
+    // ----- Shared -----
+    
+    static constexpr size_t c_command_queue_capacity = 8192;
+    CommandQueue<Command> m_commands { c_command_queue_capacity };
+    std::atomic<uint64_t> m_commands_applied { 0 };
+    std::atomic<int> m_num_virtual_voices { 0 }; // As of the last block.
+    std::atomic<uint64_t> m_num_rendered_blocks { 0 };
+    std::atomic<uint64_t> m_render_time_ns { 0 };
+    
+    // While true, the audio thread is the sole consumer of m_commands.
+    //   While false, API calls drain the queue themselves (under m_state_mutex).
+    //   In pull mode the backend's device thread takes the role of the audio thread.
     std::atomic<bool> m_running { false };
     std::thread m_thread;
     
-    mutable std::mutex m_state_mutex;
-        
+    // True if the backend drives rendering via render(). Otherwise we push from m_thread.
+    bool m_pull_mode = false;
+    std::vector<APL_SAMPLE_TYPE> m_mix_buffer;
+    
+    // Renders the next chunk. Called from the audio thread (push mode) or
+    //   from the backend's device thread (pull mode).
+    void render(APL_SAMPLE_TYPE* data, int num_frames)
+    {
+      alloc_tripwire::ScopedArm arm; // No-op unless APL_ALLOCATION_TRIPWIRE is defined.
+      const auto t0 = std::chrono::steady_clock::now();
+      drain_commands(); // Apply all API calls made since the last chunk.
+      update_3d_scene(); // Generate meta data for 3d audio.
+      mix(data, num_frames);  // Mix the next chunk.
+      const auto dt = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0);
+      m_render_time_ns.fetch_add(static_cast<uint64_t>(dt.count()), std::memory_order_relaxed);
+      m_num_rendered_blocks.fetch_add(1, std::memory_order_release);
+    }
+    
+    // Pull mode entry point.
+    void on_render_callback(APL_SAMPLE_TYPE* data, size_t frames)
+    {
+      if (m_running.load(std::memory_order_acquire))
+        render(data, static_cast<int>(frames));
+      else
+        std::fill(data, data + frames * m_backend->get_num_channels(), static_cast<APL_SAMPLE_TYPE>(0));
+    }
+    
+    // Push mode. Used by backends that don't support pull mode.
     void enter_audio_thread_loop()
     {
       auto next_frame_time = std::chrono::high_resolution_clock::now();
       
       while (m_running)
       {
-        {
-          std::scoped_lock lock(m_state_mutex);
-          update_3d_scene(); // Generate meta data for 3d audio.
-          mix();  // Mix the next chunk.
-        }
+        render(m_mix_buffer.data(), m_frame_count);
+        m_backend->write_samples(m_mix_buffer.data(), m_frame_count);
         
         // advance time by the chunk duration
         next_frame_time += std::chrono::microseconds(
@@ -74,30 +229,419 @@ namespace applaudio
       }
     }
     
-    short convert_sample_float_to_short(float sample_32f_in) const
+    // ----- Command queue -----
+    
+    // m_state_mutex must be held.
+    uint64_t push_command(const Command& cmd)
     {
-      return static_cast<short>(std::clamp(sample_32f_in * APL_SHORT_LIMIT_F, APL_SHORT_MIN_F, APL_SHORT_MAX_F));
+      for (;;)
+      {
+        auto ticket = m_commands.try_push(cmd);
+        if (ticket.has_value())
+        {
+          if (!m_running)
+            drain_commands();
+          return ticket.value();
+        }
+        // Queue is full. Wait for the mix thread to catch up.
+        if (m_running)
+          std::this_thread::yield();
+        else
+          drain_commands();
+      }
     }
     
-    void add_sample(APL_SAMPLE_TYPE& sample_sum, float st_new_sample, const Source& src)
+    // m_state_mutex must be held.
+    //   Overwrites the pending command for the same parameter if the mix thread hasn't picked it up yet.
+    void push_or_coalesce_command(const Command& cmd)
     {
-      //auto sample = (1.0 - frac) * s1 + frac * s2;
-            
-      //here: mix_buffer[f * m_output_channels + c] =
-      //here: std::clamp(mix_buffer[f * m_output_channels + c] + sample, APL_SAMPLE_MIN, APL_SAMPLE_MAX);
-
-#ifdef APL_32
-      sample_sum += st_new_sample * src.gain * src.vol_gain;
-      sample_sum = std::clamp(sample_sum, APL_SAMPLE_MIN, APL_SAMPLE_MAX);
-#else
-      auto f_new_sample = st_new_sample * 1/APL_SHORT_LIMIT_F * src.gain * src.vol_gain;
-      auto l_sample_sum = static_cast<long>(sample_sum);
-      auto l_new_sample = static_cast<long>(f_new_sample * APL_SHORT_LIMIT_F);
+      if (m_commands.num_popped() == m_commands.num_pushed())
+        m_coalesce_tickets.clear(); // All tickets are stale.
       
-      l_sample_sum += l_new_sample;
-      l_sample_sum = std::clamp(l_sample_sum, APL_SHORT_MIN_L, APL_SHORT_MAX_L);
-      sample_sum = static_cast<short>(l_sample_sum);
-#endif
+      auto key = coalesce_key(cmd);
+      auto it = m_coalesce_tickets.find(key);
+      if (it != m_coalesce_tickets.end()
+          && m_commands.try_update(it->second, [&cmd](Command& pending) { pending = cmd; }))
+        return;
+      m_coalesce_tickets[key] = push_command(cmd);
+    }
+    
+    // m_state_mutex must be held.
+    template<typename ResourceT>
+    void retire(uint64_t ticket, std::unique_ptr<ResourceT> resource)
+    {
+      RetiredResource retired;
+      retired.ticket = ticket;
+      if constexpr (std::is_same_v<ResourceT, Buffer>)
+        retired.buffer = std::move(resource);
+      else
+        retired.status = std::move(resource);
+      m_retired.emplace_back(std::move(retired));
+      
+      auto applied = m_commands_applied.load(std::memory_order_acquire);
+      std::erase_if(m_retired, [applied](const auto& r) { return r.ticket < applied; });
+    }
+    
+    bool check_num_channels(int channels) const
+    {
+      if (1 <= channels && channels <= APL_MAX_CHANNELS)
+        return true;
+      std::cerr << "ERROR: Buffers must have between 1 and " << APL_MAX_CHANNELS << " channels (got " << channels << ")." << std::endl;
+      return false;
+    }
+    
+    // m_state_mutex must be held. Converts the buffer to the output rate if the cache has room for it.
+    //   Buffers set before startup() are converted there.
+    void cache_resampled(Buffer& buffer)
+    {
+      if (m_resample_cache_budget == 0 || m_output_sample_rate <= 0 || buffer.sample_rate <= 0
+          || buffer.sample_rate == m_output_sample_rate || buffer.data.empty())
+        return;
+      const size_t src_frames = buffer.data.size() / buffer.channels;
+      const size_t dst_frames = (src_frames * m_output_sample_rate + buffer.sample_rate - 1) / buffer.sample_rate;
+      const size_t num_bytes = dst_frames * buffer.channels * sizeof(APL_SAMPLE_TYPE);
+      if (m_resample_cache_bytes + num_bytes > m_resample_cache_budget)
+        return;
+      mix_kernels::resample_buffer(buffer.data, buffer.channels, buffer.sample_rate, m_output_sample_rate, buffer.resampled);
+      buffer.resampled_rate = m_output_sample_rate;
+      m_resample_cache_bytes += num_bytes;
+    }
+    
+    // m_state_mutex must be held. Releases the buffer's share of the cache budget.
+    void uncache_resampled(const Buffer& buffer)
+    {
+      m_resample_cache_bytes -= buffer.resampled.size() * sizeof(APL_SAMPLE_TYPE);
+    }
+    
+    // m_state_mutex must be held. Hands over new buffer data to the mix thread.
+    void publish_buffer(unsigned int buf_id, std::unique_ptr<Buffer>& buffer_slot, std::unique_ptr<Buffer> buffer)
+    {
+      cache_resampled(*buffer);
+      auto ticket = push_command({ .type = CommandType::SetBufferData, .id = buf_id, .buffer = buffer.get() });
+      if (buffer_slot != nullptr)
+      {
+        uncache_resampled(*buffer_slot);
+        retire(ticket, std::move(buffer_slot));
+      }
+      buffer_slot = std::move(buffer);
+    }
+    
+    void push_source_attenuation(unsigned int src_id, const Source& src)
+    {
+      push_or_coalesce_command({ .type = CommandType::SetSourceAttenuation, .id = src_id,
+        .values = { src.constant_attenuation, src.linear_attenuation, src.quadratic_attenuation,
+                    src.min_attenuation_distance, src.max_attenuation_distance, src.attenuation_at_min_dist } });
+    }
+    
+    void push_source_3d_state_channel(unsigned int src_id, const Source& src, int ch)
+    {
+      Command cmd { .type = CommandType::SetSource3DStateChannel, .id = src_id,
+                    .arg = static_cast<unsigned int>(ch), .num_channels = src.object_3d.num_channels() };
+      src.object_3d.get_channel_state(ch, cmd.rot_mtx, cmd.pos_world, cmd.vel_world);
+      push_or_coalesce_command(cmd);
+    }
+    
+    void push_listener_3d_state_channel(int ch)
+    {
+      Command cmd { .type = CommandType::SetListener3DStateChannel, .arg = static_cast<unsigned int>(ch) };
+      listener.object_3d.get_channel_state(ch, cmd.rot_mtx, cmd.pos_world, cmd.vel_world);
+      push_or_coalesce_command(cmd);
+    }
+    
+    static uint32_t voice_index(unsigned int src_id) { return SlotMap<Source3D>::index_of(src_id); }
+    
+    bool is_playing(const Source& src) const
+    {
+      return src.playing
+        && src.status->finished_play_id.load(std::memory_order_acquire) != src.play_id;
+    }
+    
+    // Consumer side.
+    void drain_commands()
+    {
+      Command cmd;
+      while (m_commands.try_pop(cmd))
+        apply_command(cmd);
+      m_commands_applied.store(m_commands.num_popped(), std::memory_order_release);
+    }
+    
+    // Consumer side.
+    void apply_command(const Command& cmd)
+    {
+      switch (cmd.type)
+      {
+        case CommandType::None:
+          break;
+        case CommandType::CreateSource:
+          m_mix_sources.emplace_at(cmd.id, Source3D {});
+          m_voices.reset(voice_index(cmd.id), cmd.id, cmd.status);
+          m_mix_grid.remove(voice_index(cmd.id));
+          m_mix_params_3d.reset(voice_index(cmd.id));
+          break;
+        case CommandType::DestroySource:
+          m_mix_sources.erase(cmd.id);
+          m_voices.handle[voice_index(cmd.id)] = 0; // Its entry in m_mix_playing goes stale.
+          m_mix_grid.remove(voice_index(cmd.id));
+          break;
+        case CommandType::SetBufferData:
+          if (auto* buf = m_mix_buffers.find(cmd.id))
+            *buf = cmd.buffer;
+          else
+            m_mix_buffers.emplace_at(cmd.id, cmd.buffer);
+          break;
+        case CommandType::DestroyBuffer:
+          m_mix_buffers.erase(cmd.id);
+          break;
+        case CommandType::Init3DScene:
+          m_mix_3d_active = true;
+          m_mix_listener.object_3d.set_num_channels(cmd.num_channels);
+          m_mix_params_3d.set_num_listener_channels(m_mix_listener.object_3d.num_channels());
+          m_mix_listener_changed = true;
+          break;
+        case CommandType::SetListener3DStateChannel:
+          m_mix_listener.object_3d.set_channel_state(static_cast<int>(cmd.arg), cmd.rot_mtx, cmd.pos_world, cmd.vel_world);
+          m_mix_listener_changed = true;
+          break;
+        case CommandType::SetListenerRearAttenuation:
+          m_mix_listener.rear_attenuation = cmd.values[0];
+          m_mix_listener_changed = true;
+          break;
+        case CommandType::SetListenerCoordSys:
+          m_mix_listener.object_3d.set_coordsys_convention(static_cast<a3d::CoordSysConvention>(cmd.option));
+          m_mix_listener_changed = true;
+          break;
+        case CommandType::SetOutputStage:
+          m_output_stage.set_type(static_cast<OutputStageType>(cmd.option));
+          break;
+        case CommandType::SetResamplerQuality:
+          m_mix_resampler_quality = static_cast<ResamplerQuality>(cmd.option);
+          break;
+        case CommandType::SetMaxRealVoices:
+          m_mix_max_real_voices = cmd.option;
+          break;
+        case CommandType::Set3DUpdateInterval:
+          m_mix_3d_update_interval = cmd.option;
+          break;
+        case CommandType::Set3DUpdateBudget:
+          m_mix_3d_update_budget = cmd.option;
+          break;
+        case CommandType::Set3DLodThresholds:
+          m_mix_lod_reduced_below = cmd.values[0];
+          m_mix_lod_minimal_below = cmd.values[1];
+          break;
+        case CommandType::Set3DClusterAngle:
+          m_mix_3d_cluster_angle = cmd.values[0];
+          for (uint32_t v = 0; v < m_voices.handle.size(); ++v)
+            leave_cluster(v);
+          break;
+        default:
+        {
+          const uint32_t v = voice_index(cmd.id);
+          if (!m_voices.valid(v, cmd.id))
+            break;
+          apply_source_command(v, cmd);
+          if (m_voices.has(v, VoiceTable::Playing) && !m_voices.has(v, VoiceTable::InPlayList))
+          {
+            m_voices.set(v, VoiceTable::InPlayList, true);
+            m_mix_playing.emplace_back(cmd.id);
+          }
+          break;
+        }
+      }
+    }
+    
+    // Consumer side.
+    void apply_source_command(uint32_t v, const Command& cmd)
+    {
+      auto& vt = m_voices;
+      switch (cmd.type)
+      {
+        case CommandType::AttachBuffer:
+        case CommandType::DetachBuffer:
+          vt.buffer_id[v] = cmd.type == CommandType::AttachBuffer ? cmd.arg : 0;
+          vt.set(v, VoiceTable::Playing, false);
+          vt.play_phase[v] = 0;
+          vt.set(v, VoiceTable::HasLastGains, false); // May have another number of channels.
+          vt.set(v, VoiceTable::HasLastStep, false);
+          break;
+        case CommandType::PlaySource:
+          vt.set(v, VoiceTable::Playing, true);
+          if (!cmd.flag) // Not resuming.
+          {
+            vt.play_phase[v] = 0;
+            vt.set(v, VoiceTable::Virtualized, false); // A new playback starts without a fade in.
+          }
+          vt.play_id[v] = cmd.arg;
+          vt.set(v, VoiceTable::Dirty3D, true); // The listener may have moved while it was stopped.
+          vt.set(v, VoiceTable::HasLastGains, false); // Starts at its gains rather than ramping up.
+          vt.set(v, VoiceTable::HasLastStep, false);
+          leave_cluster(v);
+          break;
+        case CommandType::PauseSource:
+          vt.set(v, VoiceTable::Playing, false);
+          break;
+        case CommandType::StopSource:
+          vt.set(v, VoiceTable::Playing, false);
+          vt.play_phase[v] = 0;
+          break;
+        case CommandType::SetSourceGain:
+          vt.gain[v] = cmd.values[0];
+          break;
+        case CommandType::SetSourceVolumeGain:
+          vt.vol_gain[v] = cmd.values[0];
+          break;
+        case CommandType::SetSourcePitch:
+          vt.pitch[v] = cmd.values[0];
+          break;
+        case CommandType::SetSourceLooping:
+          vt.set(v, VoiceTable::Looping, cmd.flag);
+          break;
+        case CommandType::SetSourcePanning:
+          vt.set(v, VoiceTable::Panned, cmd.flag);
+          if (cmd.flag)
+            vt.pan[v] = cmd.values[0];
+          break;
+        case CommandType::SetSourceResamplerQuality:
+          vt.quality[v] = cmd.flag ? static_cast<int8_t>(cmd.option) : VoiceTable::c_default_quality;
+          break;
+        case CommandType::SetSourcePriority:
+          vt.priority[v] = cmd.values[0];
+          break;
+        case CommandType::EnableSource3D:
+          vt.set(v, VoiceTable::Using3D, cmd.flag);
+          vt.set(v, VoiceTable::Dirty3D, true);
+          apply_source_3d_command(*m_mix_sources.find(vt.handle[v]), cmd);
+          update_audible_range(v);
+          leave_cluster(v);
+          break;
+        case CommandType::SetSourceClusterable:
+          vt.set(v, VoiceTable::Clusterable, cmd.flag);
+          apply_source_3d_command(*m_mix_sources.find(vt.handle[v]), cmd);
+          leave_cluster(v);
+          break;
+        case CommandType::SetSource3DStateChannel:
+        case CommandType::SetSourceAudibleRadius:
+          vt.set(v, VoiceTable::Dirty3D, true);
+          apply_source_3d_command(*m_mix_sources.find(vt.handle[v]), cmd);
+          update_audible_range(v);
+          break;
+        default:
+          vt.set(v, VoiceTable::Dirty3D, true);
+          apply_source_3d_command(*m_mix_sources.find(vt.handle[v]), cmd);
+          break;
+      }
+    }
+    
+    // Consumer side.
+    void apply_source_3d_command(Source3D& src, const Command& cmd)
+    {
+      switch (cmd.type)
+      {
+        case CommandType::EnableSource3D:
+          src.object_3d.enable_3d_audio(cmd.flag);
+          break;
+        case CommandType::SetSource3DStateChannel:
+          if (src.object_3d.num_channels() != cmd.num_channels)
+            src.object_3d.set_num_channels(cmd.num_channels);
+          src.object_3d.set_channel_state(static_cast<int>(cmd.arg), cmd.rot_mtx, cmd.pos_world, cmd.vel_world);
+          break;
+        case CommandType::SetSourceSpeedOfSound:
+          src.speed_of_sound = cmd.values[0];
+          break;
+        case CommandType::SetSourceAttenuation:
+          src.constant_attenuation = cmd.values[0];
+          src.linear_attenuation = cmd.values[1];
+          src.quadratic_attenuation = cmd.values[2];
+          src.min_attenuation_distance = cmd.values[3];
+          src.max_attenuation_distance = cmd.values[4];
+          src.attenuation_at_min_dist = cmd.values[5];
+          break;
+        case CommandType::SetSourceDirectivityAlpha:
+          src.directivity_alpha = cmd.values[0];
+          break;
+        case CommandType::SetSourceDirectivitySharpness:
+          src.directivity_sharpness = cmd.values[0];
+          break;
+        case CommandType::SetSourceDirectivityType:
+          src.directivity_type = static_cast<DirectivityType>(cmd.option);
+          break;
+        case CommandType::SetSourceRearAttenuation:
+          src.rear_attenuation = cmd.values[0];
+          break;
+        case CommandType::SetSourceCoordSys:
+          src.object_3d.set_coordsys_convention(static_cast<a3d::CoordSysConvention>(cmd.option));
+          break;
+        case CommandType::SetSourceAudibleRadius:
+          src.audible_radius = cmd.values[0];
+          break;
+        case CommandType::SetSourceClusterable:
+          src.clusterable = cmd.flag;
+          break;
+        default:
+          break;
+      }
+    }
+    
+    // Consumer side. Keeps voice v in m_mix_grid as long as it is a 3D voice with an audible
+    //   radius, as a sphere around its emitters.
+    void update_audible_range(uint32_t v)
+    {
+      const auto& src = *m_mix_sources.find(m_voices.handle[v]);
+      const int n_ch = std::min(src.object_3d.num_channels(), APL_MAX_CHANNELS);
+      if (src.audible_radius <= 0.f || !src.object_3d.using_3d_audio() || n_ch == 0)
+      {
+        m_mix_grid.remove(v);
+        if (m_voices.has(v, VoiceTable::OutOfRange))
+        {
+          m_voices.set(v, VoiceTable::OutOfRange, false);
+          m_voices.set(v, VoiceTable::Dirty3D, true);
+        }
+        return;
+      }
+      la::Vec3 center;
+      const float extent = calc_bounding_sphere(src.object_3d, n_ch, center);
+      m_mix_grid.update(v, center, src.audible_radius + extent);
+    }
+    
+    // Consumer side. Makes voice v a voice of its own again, with its own 3D parameters.
+    void leave_cluster(uint32_t v)
+    {
+      if (!m_voices.has(v, VoiceTable::Clustered) && !m_voices.has(v, VoiceTable::ClusterLeader))
+        return;
+      m_voices.set(v, VoiceTable::Clustered, false);
+      m_voices.set(v, VoiceTable::ClusterLeader, false);
+      m_voices.set(v, VoiceTable::Dirty3D, true);
+    }
+    
+    // Voices out of range or merged into a cluster are virtual regardless of the voice limit.
+    bool is_culled(uint32_t v) const
+    {
+      return m_voices.has(v, VoiceTable::OutOfRange) || m_voices.has(v, VoiceTable::Clustered);
+    }
+    
+    // Returns the largest distance of the first n_ch channels of obj from their center.
+    static float calc_bounding_sphere(const a3d::Object3D& obj, int n_ch, la::Vec3& center)
+    {
+      center = la::Vec3_Zero;
+      for (int ch = 0; ch < n_ch; ++ch)
+        center += obj.get_channel_state(ch)->pos_world;
+      center = center / static_cast<float>(n_ch);
+      float radius_sq = 0.f;
+      for (int ch = 0; ch < n_ch; ++ch)
+        radius_sq = std::max(radius_sq, (obj.get_channel_state(ch)->pos_world - center).length_squared());
+      return std::sqrt(radius_sq);
+    }
+    
+    // Lets the API know that the current playback of voice v has ended by itself.
+    void publish_finished(uint32_t v)
+    {
+      if (m_voices.status[v] != nullptr)
+        m_voices.status[v]->finished_play_id.store(m_voices.play_id[v], std::memory_order_release);
+    }
+    
+    short convert_sample_float_to_short(float sample_32f_in) const
+    {
+      return static_cast<short>(std::clamp(sample_32f_in * APL_SHORT_LIMIT_F, APL_SHORT_MIN_F, APL_SHORT_MAX_F));
     }
     
     void convert_8u(std::vector<APL_SAMPLE_TYPE>& buf_trg, const std::vector<unsigned char>& buf_src) const
@@ -153,231 +697,677 @@ namespace applaudio
 #endif
     }
     
-    inline void mix_flat(Source& src, const Buffer& buf,
-                         double& pos, double pitch_adjusted_step,
-                         std::vector<APL_SAMPLE_TYPE>& mix_buffer)
+    // Gain matrix (dst_ch x src_ch, row major) for a voice without 3D audio.
+    void calc_gains_flat(uint32_t v, const Buffer& buf, float* gains) const
     {
+      const int src_ch = buf.channels;
+      const int dst_ch = m_output_channels;
+      const float gain = m_voices.gain[v] * m_voices.vol_gain[v];
+      
       float pan_left = 1.f;
       float pan_right = 1.f;
-      if (src.pan.has_value())
+      if (buf.channels == 2 && m_voices.has(v, VoiceTable::Panned))
       {
-        pan_right = src.pan.value();
+        pan_right = m_voices.pan[v];
         pan_left = 1.f - pan_right;
       }
+      
+      std::fill(gains, gains + dst_ch * src_ch, 0.f);
+      if (src_ch == dst_ch)
+      {
+        // 1→1 or 2→2 (direct copy with interpolation)
+        for (int c = 0; c < src_ch; ++c)
+          gains[c * src_ch + c] = gain * (c == 0 ? pan_left : pan_right);
+      }
+      else if (src_ch == 1 && dst_ch == 2)
+      {
+        // Mono → Stereo
+        gains[0] = gain;
+        gains[1] = gain;
+      }
+      else if (src_ch == 2 && dst_ch == 1)
+      {
+        // Stereo → Mono (average channels)
+        gains[0] = 0.5f * gain * pan_left;
+        gains[1] = 0.5f * gain * pan_right;
+      }
+    }
     
-      size_t buf_size = buf.data.size();
-      for (int f = 0; f < m_frame_count; ++f)
+    // The doppler shift of a 3D voice is the one furthest from 1 among its channel pairs.
+    float calc_doppler_3d(uint32_t v, const Buffer& buf) const
+    {
+      const int num_emitters = m_mix_params_3d.num_emitters(v);
+      const int n_ch_l = std::min(m_output_channels, m_mix_params_3d.num_listener_channels());
+      float doppler_shift = 1.f;
+      if (num_emitters == 0)
+        return doppler_shift;
+      for (int ch_s = 0; ch_s < buf.channels; ++ch_s)
       {
-        size_t idx = static_cast<size_t>(pos) * buf.channels;
-        if (idx + buf.channels > buf_size)
-        {
-          if (src.looping)
-          {
-            pos = 0.0; // wrap
-            idx = 0;
-          }
-          else
-          {
-            src.playing = false;
-            break;
-          }
-        }
-        
-        // Linear interpolation between samples
-        //   because pos is not an integer.
-        
-        size_t idx_curr = idx;
-        size_t idx_next = idx_curr + buf.channels;
-        double frac = pos - std::floor(pos);
-        
-        if (buf.channels == m_output_channels)
-        {
-          // 1→1 or 2→2 (direct copy with interpolation)
-          bool do_pan = buf.channels == 2 && src.pan.has_value();
-          for (int c = 0; c < buf.channels; ++c)
-          {
-            auto s1 = buf.data[idx_curr + c];
-            auto s2 = (idx_next + c < buf_size) ? buf.data[idx_next + c] : s1;
-            auto sample = static_cast<float>((1.0 - frac) * s1 + frac * s2);
-            if (do_pan && c == 0)
-              sample *= pan_left;
-            if (do_pan && c == 1)
-              sample *= pan_right;
-            
-            add_sample(mix_buffer[f * m_output_channels + c], sample, src);
-          }
-        }
-        else if (buf.channels == 1 && m_output_channels == 2)
-        {
-          // Mono → Stereo
-          auto s1 = buf.data[idx_curr];
-          auto s2 = (idx_next < buf_size) ? buf.data[idx_next] : s1;
-          auto sample = static_cast<float>((1.0 - frac) * s1 + frac * s2);
-          
-          for (int c = 0; c < 2; ++c)
-            add_sample(mix_buffer[f * 2 + c], sample, src);
-        }
-        else if (buf.channels == 2 && m_output_channels == 1)
+        const float* doppler_shifts = m_mix_params_3d.doppler_shifts(v, a3d::ParamTable::emitter_of(ch_s, num_emitters));
+        for (int ch_l = 0; ch_l < n_ch_l; ++ch_l)
+          if (std::abs(doppler_shift - 1.f) < std::abs(doppler_shifts[ch_l] - 1.f))
+            doppler_shift = doppler_shifts[ch_l];
+      }
+      return doppler_shift;
+    }
+    
+    // The gain times volume of the voice, or of the whole cluster it leads.
+    float calc_source_gain(uint32_t v) const
+    {
+      return m_voices.has(v, VoiceTable::ClusterLeader) ? m_voices.cluster_gain[v] : m_voices.gain[v] * m_voices.vol_gain[v];
+    }
+    
+    // The loudest gain the voice is mixed with. All gains of the voice are 0 iff this is 0.
+    float calc_effective_gain(uint32_t v, const Buffer& buf) const
+    {
+      float gain = calc_source_gain(v);
+      if (m_voices.has(v, VoiceTable::Using3D))
+      {
+        // Buffer channels beyond the emitters reuse emitter 0, so the emitters cover all pairs.
+        const int num_emitters = std::min(m_mix_params_3d.num_emitters(v), buf.channels);
+        const int n_ch_l = std::min(m_output_channels, m_mix_params_3d.num_listener_channels());
+        float max_gain = 0.f;
+        for (int ch_s = 0; ch_s < num_emitters; ++ch_s)
         {
-          // Stereo → Mono (average channels, then interpolate between frames)
-          auto l1 = buf.data[idx_curr + 0];
-          auto r1 = buf.data[idx_curr + 1];
-          auto l2 = (idx_next + 0 < buf_size) ? buf.data[idx_next + 0] : l1;
-          auto r2 = (idx_next + 1 < buf_size) ? buf.data[idx_next + 1] : r1;
-          
-          auto s1 = (l1 + r1) / 2.0;
-          auto s2 = (l2 + r2) / 2.0;
-          
-          if (buf.channels == 2 && src.pan.has_value())
-          {
-            s1 *= pan_left;
-            s2 *= pan_right;
-          }
-          
-          auto mono_sample = static_cast<float>((1.0 - frac) * s1 + frac * s2);
-          
-          add_sample(mix_buffer[f], mono_sample, src);
+          const float* gains = m_mix_params_3d.gains(v, ch_s);
+          for (int ch_l = 0; ch_l < n_ch_l; ++ch_l)
+            max_gain = std::max(max_gain, gains[ch_l]);
         }
-        
-        pos += pitch_adjusted_step; // pitch = playback speed
+        gain *= max_gain;
       }
+      return gain;
     }
     
+    // Decides which voices are mixed when there are more than m_mix_max_real_voices.
+    float calc_audibility(const ActiveVoice& voice) const
+    {
+      return m_voices.priority[voice.voice] * calc_effective_gain(voice.voice, *voice.buf);
+    }
     
-    inline void mix_3d(const Listener& listener, Source& src, const Buffer& buf,
-                       double& pos, double pitch_adjusted_step,
-                       std::vector<APL_SAMPLE_TYPE>& mix_buffer)
+    // Gain matrix (dst_ch x src_ch, row major) for a 3D voice.
+    //   Projects each source channel to each listener channel.
+    void calc_gains_3d(uint32_t v, const Buffer& buf, float* gains) const
     {
       const int src_ch = buf.channels;
       const int dst_ch = m_output_channels;
-      const size_t buf_size = buf.data.size();
-      const bool do_pan = buf.channels == 2 && src.pan.has_value();
+      const float gain = calc_source_gain(v);
+      const bool panned = m_voices.has(v, VoiceTable::Panned);
+      const bool do_pan = buf.channels == 2 && panned;
       
       float pan_left = 1.f;
       float pan_right = 1.f;
-      if (src.pan.has_value())
+      if (panned)
       {
-        pan_right = src.pan.value();
+        pan_right = m_voices.pan[v];
         pan_left = 1.f - pan_right;
       }
       
-      // Dynamic temp to avoid overflow for >2ch sources.
-      std::vector<float> src_samples(src_ch);
+      const int num_emitters = m_mix_params_3d.num_emitters(v);
+      const int num_listener_ch = m_mix_params_3d.num_listener_channels();
+      for (int ch_l = 0; ch_l < dst_ch; ++ch_l)
+      {
+        for (int ch_s = 0; ch_s < src_ch; ++ch_s)
+        {
+          float& g = gains[ch_l * src_ch + ch_s];
+          g = 0.f;
+          
+          const int ch_e = a3d::ParamTable::emitter_of(ch_s, num_emitters);
+          if (ch_e < 0 || ch_l >= num_listener_ch)
+            continue;
+          
+          // Apply attenuation gain.
+          g = m_mix_params_3d.gains(v, ch_e)[ch_l] * gain;
+          if (do_pan && ch_s == 0) g *= pan_left;
+          if (do_pan && ch_s == 1) g *= pan_right;
+        }
+      }
+    }
+    
+    // Drops a tier when the effective gain (which includes the 3D attenuation) falls below the
+    //   tier's threshold, and only climbs back once it exceeds the threshold by c_lod_hysteresis,
+    //   so that a voice hovering around a threshold doesn't flap between tiers.
+    LodTier select_lod(LodTier tier, float effective_gain) const
+    {
+      const bool above_minimal = effective_gain >= m_mix_lod_minimal_below
+        * (tier == LodTier::Minimal ? c_lod_hysteresis : 1.f);
+      const bool above_reduced = effective_gain >= m_mix_lod_reduced_below
+        * (tier != LodTier::Full ? c_lod_hysteresis : 1.f);
+      if (!above_minimal)
+        return LodTier::Minimal;
+      return above_reduced ? LodTier::Full : LodTier::Reduced;
+    }
+    
+    // True if the voice was last mixed with any gain above 0.
+    bool mixed_audibly(uint32_t v, const Buffer& buf)
+    {
+      if (!m_voices.has(v, VoiceTable::HasLastGains))
+        return false;
+      const float* last_gains = m_voices.last_gains_of(v);
+      return std::any_of(last_gains, last_gains + m_output_channels * buf.channels, [](float g) { return g != 0.f; });
+    }
+    
+    void mix_voice(const ActiveVoice& voice, MixScratch& scratch, float* bus, int num_frames)
+    {
+      auto& vt = m_voices;
+      const uint32_t v = voice.voice;
+      const auto& buf = *voice.buf;
+      const bool looping = vt.has(v, VoiceTable::Looping);
       
-      for (int f = 0; f < m_frame_count; ++f)
+      // Calculate pitch adjustment for sample rate conversion.
+      double sample_rate_ratio = static_cast<double>(buf.sample_rate) / m_output_sample_rate;
+      double pitch_adjusted_step = vt.pitch[v] * sample_rate_ratio;
+      
+      // Gains and doppler are constant over the block, so they are hoisted out of the kernels.
+      float doppler_shift = 1.f;
+      if (vt.has(v, VoiceTable::Using3D))
       {
-        size_t i0 = static_cast<size_t>(pos) * src_ch;
-        size_t i1 = i0 + src_ch;
-        
-        // ---- EARLY BOUNDS CHECK (like mix_flat) ----
-        if (i0 + src_ch > buf_size)
+        calc_gains_3d(v, buf, scratch.gains.data());
+        doppler_shift = calc_doppler_3d(v, buf);
+      }
+      else
+        calc_gains_flat(v, buf, scratch.gains.data());
+      pitch_adjusted_step *= doppler_shift;
+      
+      // At unity pitch the buffer's copy at the output rate is played as is, if it has one.
+      //   The position is moved between the two rates whenever a voice switches.
+      bool use_resampled = vt.pitch[v] == 1.f && doppler_shift == 1.f
+        && buf.resampled_rate == m_output_sample_rate && !buf.resampled.empty();
+      // The copy's ends were filtered against silence, so a looping voice resamples live in the
+      //   blocks around the loop point, with the sinc the copy was made with so that they match.
+      bool live_at_seam = false;
+      if (use_resampled && looping)
+      {
+        const uint64_t phase = vt.has(v, VoiceTable::Resampled) ? vt.play_phase[v] :
+          mix_kernels::rescale_phase(vt.play_phase[v], m_output_sample_rate, buf.sample_rate);
+        const size_t pos = static_cast<size_t>(phase >> mix_kernels::c_phase_frac_bits);
+        const size_t copy_frames = buf.resampled.size() / buf.channels;
+        // The frames of the copy that the 32 tap sinc filled from beyond its ends, plus the taps
+        //   of playing it from a fractional position.
+        const size_t margin = static_cast<size_t>(17 * m_output_sample_rate / buf.sample_rate) + 17;
+        live_at_seam = pos < margin || pos + num_frames + margin >= copy_frames;
+        use_resampled = !live_at_seam;
+      }
+      const bool switched_rate = use_resampled != vt.has(v, VoiceTable::Resampled);
+      if (switched_rate)
+      {
+        vt.play_phase[v] = use_resampled ?
+          mix_kernels::rescale_phase(vt.play_phase[v], m_output_sample_rate, buf.sample_rate) :
+          mix_kernels::rescale_phase(vt.play_phase[v], buf.sample_rate, m_output_sample_rate);
+        vt.set(v, VoiceTable::Resampled, use_resampled);
+      }
+      const auto& data = use_resampled ? buf.resampled : buf.data;
+      
+      mix_kernels::VoiceBlock block;
+      block.data = data.data();
+      block.buf_frames = buf.channels > 0 ? data.size() / buf.channels : 0;
+      block.src_ch = buf.channels;
+      block.dst_ch = m_output_channels;
+      block.phase = vt.play_phase[v];
+      block.step = use_resampled ? mix_kernels::c_phase_one : mix_kernels::to_phase_step(pitch_adjusted_step);
+      block.quality = live_at_seam ? ResamplerQuality::Sinc32 : vt.get_quality(v, m_mix_resampler_quality);
+      block.fade = voice.fade;
+      block.gains = scratch.gains.data();
+      block.scratch = scratch.samples.data();
+      block.stride = static_cast<size_t>(num_frames);
+      block.num_frames = num_frames;
+      block.out = bus;
+      
+      // Gains and step ramp from what the last block was mixed with, so that changes to them,
+      //   whether from the API or from a 3D update, don't step. A fade in starts from silence anyway.
+      const int num_gains = m_output_channels * buf.channels;
+      float* last_gains = vt.last_gains_of(v);
+      // Voices below LodTier::Full are mixed down to mono first, which is the same as every source
+      //   channel having the mean of its row of gains. last_gains is kept in that full form.
+      const bool collapse = vt.lod[v] != LodTier::Full && buf.channels > 1;
+      float* gains = scratch.gains.data();
+      if (collapse)
+        for (int l = 0; l < m_output_channels; ++l)
         {
-          if (src.looping)
-          {
-            pos = 0.0;    // Wrap and restart this frame.
-            i0 = 0; i1 = src_ch;
-          }
-          else
-          {
-            src.playing = false;
-            break;
-          }
+          float* row = gains + l * buf.channels;
+          std::fill(row, row + buf.channels, std::accumulate(row, row + buf.channels, 0.f) / buf.channels);
         }
-        
-        const double frac = pos - std::floor(pos);
-        
-        // Interpolate per source channel.
-        for (int ch_s = 0; ch_s < src_ch; ++ch_s)
+      const bool ramp = voice.fade >= 0;
+      if (ramp && vt.has(v, VoiceTable::HasLastGains) && !std::equal(gains, gains + num_gains, last_gains))
+        block.gains_begin = last_gains;
+      std::array<float, APL_MAX_CHANNELS> mono_gains, mono_gains_begin;
+      if (collapse)
+      {
+        for (int l = 0; l < m_output_channels; ++l)
+          mono_gains[l] = gains[l * buf.channels];
+        if (block.gains_begin != nullptr)
+          for (int l = 0; l < m_output_channels; ++l)
+            mono_gains_begin[l] = std::accumulate(last_gains + l * buf.channels, last_gains + (l + 1) * buf.channels, 0.f) / buf.channels;
+        block.gains = mono_gains.data();
+        block.gains_begin = block.gains_begin != nullptr ? mono_gains_begin.data() : nullptr;
+        block.collapse_to_mono = true;
+      }
+      block.ramp_step = ramp && vt.has(v, VoiceTable::HasLastStep) && !use_resampled && !switched_rate
+        && vt.last_step[v] != block.step;
+      block.step_begin = vt.last_step[v];
+      
+      // Specialized on channel counts and looping, picked once per voice per block.
+      //   The resampler quality is switched on inside, also once per block.
+      mix_kernels::select_voice_kernel(buf.channels, m_output_channels, looping)(block);
+      vt.play_phase[v] = block.phase;
+      std::copy(gains, gains + num_gains, last_gains);
+      vt.last_step[v] = block.step;
+      vt.set(v, VoiceTable::HasLastGains, true);
+      vt.set(v, VoiceTable::HasLastStep, !use_resampled);
+      
+      if (!block.playing)
+      {
+        vt.set(v, VoiceTable::Playing, false);
+        publish_finished(v);
+      }
+    }
+    
+    // Moves a voice that isn't mixed (silent or virtual) num_frames output frames ahead,
+    //   the same way mixing it would, in O(1) and without reading the buffer.
+    void advance_voice(uint32_t v, const Buffer& buf, int num_frames)
+    {
+      auto& vt = m_voices;
+      double sample_rate_ratio = static_cast<double>(buf.sample_rate) / m_output_sample_rate;
+      double pitch_adjusted_step = vt.pitch[v] * sample_rate_ratio;
+      if (vt.has(v, VoiceTable::Using3D))
+        pitch_adjusted_step *= calc_doppler_3d(v, buf);
+      
+      if (vt.has(v, VoiceTable::Resampled))
+      {
+        vt.play_phase[v] = mix_kernels::rescale_phase(vt.play_phase[v], buf.sample_rate, m_output_sample_rate);
+        vt.set(v, VoiceTable::Resampled, false);
+      }
+      const size_t buf_frames = buf.channels > 0 ? buf.data.size() / buf.channels : 0;
+      const uint64_t end_phase = static_cast<uint64_t>(buf_frames) << mix_kernels::c_phase_frac_bits;
+      vt.play_phase[v] += mix_kernels::to_phase_step(pitch_adjusted_step) * num_frames;
+      if (vt.play_phase[v] >= end_phase)
+      {
+        if (vt.has(v, VoiceTable::Looping) && end_phase > 0)
+          vt.play_phase[v] %= end_phase;
+        else
         {
-          const float s1 = buf.data[i0 + ch_s];
-          const float s2 = (i1 + ch_s < buf_size) ? buf.data[i1 + ch_s] : s1;
-          float sample = static_cast<float>((1.0 - frac) * s1 + frac * s2);
-          if (do_pan && ch_s == 0) sample *= pan_left;
-          if (do_pan && ch_s == 1) sample *= pan_right;
-          src_samples[ch_s] = sample;
+          vt.set(v, VoiceTable::Playing, false);
+          publish_finished(v);
         }
-        
-        float doppler_shift = 1.f;
-        
-        // Project each source channel to each listener channel.
-        for (int ch_l = 0; ch_l < dst_ch; ++ch_l)
+      }
+    }
+    
+    // Keeps the m_mix_max_real_voices most audible voices in m_active_voices and only advances the
+    //   positions of the others. A voice changing state is ramped over one block: a voice that drops
+    //   out is mixed once more fading out and a voice that comes back fades in, so neither clicks.
+    void virtualize_voices(int num_frames)
+    {
+      // Voices out of range or clustered are virtual regardless of the limit. The rest keep
+      //   their order unless some are.
+      auto in_range = [this](const ActiveVoice& voice) { return !is_culled(voice.voice); };
+      auto in_range_end = m_active_voices.end();
+      if ((m_mix_grid.size() > 0 || m_mix_3d_cluster_angle > 0.f)
+          && !std::all_of(m_active_voices.begin(), m_active_voices.end(), in_range))
+        in_range_end = std::partition(m_active_voices.begin(), m_active_voices.end(), in_range);
+      const size_t num_in_range = static_cast<size_t>(in_range_end - m_active_voices.begin());
+      
+      const auto max_real = static_cast<size_t>(std::max(m_mix_max_real_voices, 0));
+      const bool over_limit = max_real > 0 && num_in_range > max_real;
+      if (over_limit)
+      {
+        for (auto it = m_active_voices.begin(); it != in_range_end; ++it)
+          it->audibility = calc_audibility(*it);
+        std::nth_element(m_active_voices.begin(), m_active_voices.begin() + max_real, in_range_end,
+                         [](const auto& a, const auto& b) { return a.audibility > b.audibility; });
+      }
+      
+      const size_t num_real = over_limit ? max_real : num_in_range;
+      for (size_t i = 0; i < num_real; ++i)
+      {
+        const uint32_t v = m_active_voices[i].voice;
+        if (m_voices.has(v, VoiceTable::Virtualized))
         {
-          float sum = 0.f;
-          for (int ch_s = 0; ch_s < src_ch; ++ch_s)
-          {
-            const auto* state_s = src.object_3d.get_channel_state(ch_s);
-            if (!state_s)
-              continue;  // guard null
-            if (ch_l >= static_cast<int>(state_s->listener_ch_params.size()))
-              continue;
-            
-            // Apply doppler shift scaling and attenuation gain.
-            const auto& p = state_s->listener_ch_params[ch_l];
-            if (std::abs(doppler_shift - 1.f) < std::abs(p.doppler_shift - 1.f))
-              doppler_shift = p.doppler_shift;
-            
-            sum += src_samples[ch_s] * p.gain;
-          }
-          
-          add_sample(mix_buffer[f * dst_ch + ch_l], sum, src);
+          m_voices.set(v, VoiceTable::Virtualized, false);
+          m_active_voices[i].fade = 1;
         }
-        
-        pos += pitch_adjusted_step * doppler_shift;
+      }
+      
+      size_t num_mixed = num_real;
+      for (size_t i = num_real; i < m_active_voices.size(); ++i)
+      {
+        auto voice = m_active_voices[i];
+        if (m_voices.has(voice.voice, VoiceTable::Virtualized))
+          advance_voice(voice.voice, *voice.buf, num_frames);
+        else
+        {
+          m_voices.set(voice.voice, VoiceTable::Virtualized, true);
+          voice.fade = -1;
+          m_active_voices[num_mixed++] = voice;
+        }
+      }
+      m_num_virtual_voices.store(static_cast<int>(m_active_voices.size() - num_real) + m_mix_num_out_of_range, std::memory_order_relaxed);
+      m_active_voices.erase(m_active_voices.begin() + num_mixed, m_active_voices.end());
+    }
+    
+    // Chunk 0 mixes into m_mix_bus, the others into their own bus.
+    void mix_chunk(int chunk, int thread_idx, int num_frames)
+    {
+      float* bus = chunk == 0 ? m_mix_bus.data() : m_mix_buses[chunk - 1].data();
+      std::fill(bus, bus + num_frames * m_output_channels, 0.f);
+      
+      auto& scratch = m_mix_scratch[thread_idx];
+      const int num_voices = static_cast<int>(m_active_voices.size());
+      const int v_end = std::min(num_voices, (chunk + 1) * c_voices_per_mix_chunk);
+      for (int v = chunk * c_voices_per_mix_chunk; v < v_end; ++v)
+        mix_voice(m_active_voices[v], scratch, bus, num_frames);
+    }
+    
+    void add_bus(float* __restrict dst, const float* __restrict bus, size_t num_samples) const
+    {
+      for (size_t i = 0; i < num_samples; ++i)
+        dst[i] += bus[i];
+    }
+    
+    // Grows the mix side scratch memory where needed. startup() calls this with the worst case,
+    //   which makes the calls from mix() no-ops, so the mix thread doesn't allocate.
+    void reserve_mix_state(int num_frames, int max_voices, int max_src_channels)
+    {
+      const size_t num_samples = static_cast<size_t>(num_frames) * m_output_channels;
+      if (m_active_voices.capacity() < static_cast<size_t>(max_voices))
+        m_active_voices.reserve(max_voices);
+      
+      if (m_mix_bus.size() < num_samples)
+        m_mix_bus.resize(num_samples);
+      const int num_buses = std::max((max_voices + c_voices_per_mix_chunk - 1) / c_voices_per_mix_chunk - 1, 0);
+      if (m_mix_buses.size() < static_cast<size_t>(num_buses))
+        m_mix_buses.resize(num_buses);
+      for (auto& bus : m_mix_buses)
+        if (bus.size() < num_samples)
+          bus.resize(num_samples);
+      
+      const size_t scratch_size = static_cast<size_t>(num_frames) * max_src_channels;
+      const size_t gains_size = static_cast<size_t>(m_output_channels) * max_src_channels;
+      if (m_mix_scratch.size() < static_cast<size_t>(m_mix_workers.num_threads()))
+        m_mix_scratch.resize(m_mix_workers.num_threads());
+      for (auto& scratch : m_mix_scratch)
+      {
+        if (scratch.samples.size() < scratch_size)
+          scratch.samples.resize(scratch_size);
+        if (scratch.gains.size() < gains_size)
+          scratch.gains.resize(gains_size);
       }
     }
     
-    void mix()
+    // Mixes num_frames interleaved frames into mix_buffer.
+    void mix(APL_SAMPLE_TYPE* mix_buffer, int num_frames)
     {
-      std::vector<APL_SAMPLE_TYPE> mix_buffer(m_frame_count * m_output_channels, 0);
+      const size_t num_samples = static_cast<size_t>(num_frames) * m_output_channels;
       
-      for (auto& [id, src] : m_sources)
+      m_active_voices.clear();
+      m_mix_num_out_of_range = 0;
+      int max_src_channels = 1;
+      size_t num_playing = 0;
+      for (auto src_id : m_mix_playing)
       {
-        if (!src.playing)
+        const uint32_t v = voice_index(src_id);
+        if (!m_voices.valid(v, src_id)) // Destroyed.
           continue;
+        if (!m_voices.has(v, VoiceTable::Playing))
+        {
+          m_voices.set(v, VoiceTable::InPlayList, false);
+          continue;
+        }
+        m_mix_playing[num_playing++] = src_id;
         
-        if (src.buffer_id == 0) // invalid source id
+        const unsigned int buf_id = m_voices.buffer_id[v];
+        if (buf_id == 0) // invalid source id
           continue;
         
         // Safety check: make sure the buffer actually exists
-        auto buf_it = m_buffers.find(src.buffer_id);
-        if (buf_it == m_buffers.end())
+        auto* buf_slot = m_mix_buffers.find(buf_id);
+        if (buf_slot == nullptr)
         {
           // Buffer was destroyed but source still references it
-          src.buffer_id = 0; // Auto-detach invalid buffer
-          src.playing = false;
+          m_voices.buffer_id[v] = 0; // Auto-detach invalid buffer
+          m_voices.set(v, VoiceTable::Playing, false);
+          publish_finished(v);
           continue;
         }
         
-        const auto& buf = buf_it->second;
-        double pos = src.play_pos;
-        
-        // Calculate pitch adjustment for sample rate conversion.
-        double sample_rate_ratio = static_cast<double>(buf.sample_rate) / m_output_sample_rate;
-        double pitch_adjusted_step = src.pitch * sample_rate_ratio;
-        
-        if (src.object_3d.using_3d_audio())
-          mix_3d(listener, src, buf,
-                 pos, pitch_adjusted_step,
-                 mix_buffer);
-        else
-          mix_flat(src, buf,
-                   pos, pitch_adjusted_step,
-                   mix_buffer);
+        // A voice out of range or clustered that has faded out already (or is silent anyway) just
+        //   moves on, like one with all gains at 0, which would only add zeros.
+        const Buffer* buf = *buf_slot;
+        const float effective_gain = calc_effective_gain(v, *buf);
+        if (is_culled(v) && (m_voices.has(v, VoiceTable::Virtualized) || effective_gain == 0.f))
+        {
+          m_voices.set(v, VoiceTable::Virtualized, true);
+          advance_voice(v, *buf, num_frames);
+          ++m_mix_num_out_of_range;
+          continue;
+        }
+        // Unless it was audible in the last block, in which case it's mixed once more to ramp down.
+        if (effective_gain == 0.f && !mixed_audibly(v, *buf))
+        {
+          advance_voice(v, *buf, num_frames);
+          continue;
+        }
+        m_voices.lod[v] = m_voices.has(v, VoiceTable::Using3D) ? select_lod(m_voices.lod[v], effective_gain) : LodTier::Full;
         
-        src.play_pos = pos;
+        m_active_voices.push_back({ v, buf });
+        max_src_channels = std::max(max_src_channels, buf->channels);
       }
+      m_mix_playing.resize(num_playing); // Only shrinks.
+      virtualize_voices(num_frames);
+      
+      const int num_voices = static_cast<int>(m_active_voices.size());
+      const int num_chunks = (num_voices + c_voices_per_mix_chunk - 1) / c_voices_per_mix_chunk;
+      reserve_mix_state(num_frames, num_voices, max_src_channels); // No-op unless startup() reserved too little.
       
-      m_backend->write_samples(mix_buffer.data(), m_frame_count);
+      auto mix_chunk_task = [this, num_frames](int chunk, int thread_idx)
+      {
+        alloc_tripwire::ScopedArm arm;
+        mix_chunk(chunk, thread_idx, num_frames);
+      };
+      if (num_chunks == 0)
+        std::fill(m_mix_bus.data(), m_mix_bus.data() + num_samples, 0.f);
+      else if (num_chunks > 1 && m_mix_workers.num_threads() > 1 && num_voices >= m_parallel_mix_min_voices)
+        m_mix_workers.run(num_chunks, mix_chunk_task);
+      else
+        for (int c = 0; c < num_chunks; ++c)
+          mix_chunk_task(c, 0);
+      
+      // Always sum in chunk order, so the result doesn't depend on the number of threads.
+      for (int c = 1; c < num_chunks; ++c)
+        add_bus(m_mix_bus.data(), m_mix_buses[c - 1].data(), num_samples);
+      
+      // The only clamp in the chain.
+      m_output_stage.process(m_mix_bus.data(), num_frames, mix_buffer);
     }
     
     bool update_3d_scene()
     {
-      if (scene_3d != nullptr)
+      if (!m_mix_3d_active)
+        return false;
+      // With an update interval of N blocks, only every Nth block is a full update, and the
+      //   voices ramp between them. Voices that just started get their parameters right away.
+      const bool full_update = ++m_mix_3d_blocks_since_update >= m_mix_3d_update_interval;
+      if (full_update)
+        m_mix_3d_blocks_since_update = 0;
+      const int n_ch_l = m_mix_listener.object_3d.num_channels();
+      la::Vec3 center_l;
+      const float extent_l = n_ch_l > 0 ? calc_bounding_sphere(m_mix_listener.object_3d, n_ch_l, center_l) : 0.f;
+      // Voices in m_mix_grid are out of range unless the listener is within their audible radius.
+      if (full_update && m_mix_grid.size() > 0 && n_ch_l > 0)
+        m_mix_grid.query(center_l, extent_l, [](uint32_t) {});
+      const bool clustering = full_update && m_mix_3d_cluster_angle > 0.f && n_ch_l > 0;
+      m_mix_cluster_entries.clear();
+      m_mix_3d_candidates.clear();
+      
+      // Only playing 3D voices read the parameters. They are recomputed when the voice or the
+      //   listener changed since, so static voices cost nothing while the listener stands still.
+      m_mix_scene_3d.begin_batch();
+      for (auto src_id : m_mix_playing)
       {
-        scene_3d->update_scene(listener, m_sources);
-        return true;
+        const uint32_t v = voice_index(src_id);
+        if (!m_voices.valid(v, src_id) || !m_voices.has(v, VoiceTable::Playing) || !m_voices.has(v, VoiceTable::Using3D))
+          continue;
+        if (!full_update)
+        {
+          if (m_voices.has(v, VoiceTable::Dirty3D) && !m_voices.has(v, VoiceTable::HasLastGains)
+              && !m_voices.has(v, VoiceTable::Clustered) && !m_voices.has(v, VoiceTable::ClusterLeader))
+          {
+            m_mix_scene_3d.add_source(*m_mix_sources.find(src_id), m_mix_params_3d, v);
+            m_voices.set(v, VoiceTable::Dirty3D, false);
+          }
+          continue;
+        }
+        if (m_mix_grid.contains(v))
+        {
+          const bool out_of_range = !m_mix_grid.hit_by_last_query(v);
+          if (!out_of_range && m_voices.has(v, VoiceTable::OutOfRange))
+            m_voices.set(v, VoiceTable::Dirty3D, true); // Missed the changes while out of range.
+          m_voices.set(v, VoiceTable::OutOfRange, out_of_range);
+          if (out_of_range)
+            continue;
+        }
+        if (clustering && m_voices.has(v, VoiceTable::Clusterable))
+        {
+          add_cluster_entry(v, center_l);
+          continue;
+        }
+        if (m_mix_listener_changed || m_voices.has(v, VoiceTable::Dirty3D))
+          schedule_3d_update(v, center_l);
+      }
+      if (clustering)
+        form_clusters(center_l);
+      run_3d_update_schedule();
+      m_mix_scene_3d.end_batch(m_mix_listener, m_mix_params_3d);
+      if (full_update)
+        m_mix_listener_changed = false;
+      return true;
+    }
+    
+    // Updates voice v in this batch, or with a budget, makes it a candidate ranked by urgency:
+    //   how audible it is, how fast it moves relative to the listener for its distance, and how
+    //   many updates it has waited. Voices that were never updated don't wait.
+    void schedule_3d_update(uint32_t v, const la::Vec3& center_l)
+    {
+      const auto& src = *m_mix_sources.find(m_voices.handle[v]);
+      if (m_mix_3d_update_budget <= 0 || !m_voices.has(v, VoiceTable::HasLastGains))
+      {
+        m_mix_scene_3d.add_source(src, m_mix_params_3d, v);
+        m_voices.set(v, VoiceTable::Dirty3D, false);
+        m_voices.stale_3d[v] = 0;
+        return;
+      }
+      float importance = c_min_update_importance;
+      if (auto* buf = m_mix_buffers.find(m_voices.buffer_id[v]))
+        importance += m_voices.priority[v] * calc_effective_gain(v, **buf);
+      const int n_ch_s = src.object_3d.num_channels();
+      if (n_ch_s > 0 && m_mix_listener.object_3d.num_channels() > 0)
+      {
+        la::Vec3 center_s;
+        calc_bounding_sphere(src.object_3d, n_ch_s, center_s);
+        const la::Vec3 vel_rel = src.object_3d.get_channel_state(0)->vel_world
+          - m_mix_listener.object_3d.get_channel_state(0)->vel_world;
+        // Roughly the rate at which its direction and distance change, in radians or e-folds per second.
+        importance *= 1.f + vel_rel.length() / std::max((center_s - center_l).length(), 0.1f);
+      }
+      m_mix_3d_candidates.push_back({ importance * static_cast<float>(m_voices.stale_3d[v] + 1), v });
+      m_voices.set(v, VoiceTable::Dirty3D, true); // Stays due, also after m_mix_listener_changed is reset.
+    }
+    
+    // Updates the m_mix_3d_update_budget most urgent candidates. The rest wait for the next full
+    //   update and grow more urgent, so every voice gets its turn eventually.
+    void run_3d_update_schedule()
+    {
+      auto& candidates = m_mix_3d_candidates;
+      const size_t budget = static_cast<size_t>(std::max(m_mix_3d_update_budget, 0));
+      if (candidates.size() > budget)
+        std::nth_element(candidates.begin(), candidates.begin() + budget, candidates.end(),
+                         [](const auto& a, const auto& b) { return a.urgency > b.urgency; });
+      for (size_t i = 0; i < candidates.size(); ++i)
+      {
+        const uint32_t v = candidates[i].voice;
+        if (i < budget)
+        {
+          m_mix_scene_3d.add_source(*m_mix_sources.find(m_voices.handle[v]), m_mix_params_3d, v);
+          m_voices.set(v, VoiceTable::Dirty3D, false);
+          m_voices.stale_3d[v] = 0;
+        }
+        else
+          ++m_voices.stale_3d[v];
+      }
+    }
+    
+    // Files voice v under its buffer, whether it loops, its pitch (in bands of a tenth of a
+    //   semitone), the direction it is heard from (in cells of about m_mix_3d_cluster_angle) and
+    //   its distance (in bands of a factor sqrt(2), about 3 dB of attenuation apart).
+    void add_cluster_entry(uint32_t v, const la::Vec3& center_l)
+    {
+      const auto& src = *m_mix_sources.find(m_voices.handle[v]);
+      ClusterEntry entry;
+      entry.voice = v;
+      calc_bounding_sphere(src.object_3d, src.object_3d.num_channels(), entry.center);
+      const la::Vec3 d = entry.center - center_l;
+      const float dist = std::max(d.length(), 1e-3f);
+      // As |d.x()| <= dist, the cells span +-1 / angle. Non-finite positions go to cell 0 or the ends.
+      const float cells_per_unit = 1.f / (m_mix_3d_cluster_angle * dist);
+      auto to_int = [](float x) { return std::isnan(x) ? 0 : static_cast<int32_t>(std::floor(std::clamp(x, -1e9f, 1e9f))); };
+      entry.key = { static_cast<int32_t>(m_voices.buffer_id[v]), m_voices.has(v, VoiceTable::Looping) ? 1 : 0,
+                    to_int(120.f * std::log2(m_voices.pitch[v]) + 0.5f),
+                    to_int(d.x() * cells_per_unit), to_int(d.y() * cells_per_unit), to_int(d.z() * cells_per_unit),
+                    to_int(2.f * std::log2(dist)) };
+      m_mix_cluster_entries.push_back(entry);
+    }
+    
+    // Voices with equal keys are mixed as one: the voice with the lowest slot leads, placed at
+    //   the centroid and moving with the mean velocity of the cluster, with the power sum of the
+    //   gains. The others are virtual: the cluster is heard at the leader's play position, while
+    //   theirs run on silently and are heard again when the cluster breaks up.
+    //   Everyone in a cluster stays Dirty3D, so whoever leaves it gets its own parameters back.
+    void form_clusters(const la::Vec3& center_l)
+    {
+      auto& entries = m_mix_cluster_entries;
+      std::sort(entries.begin(), entries.end());
+      for (size_t begin = 0, end = 0; begin < entries.size(); begin = end)
+      {
+        end = begin + 1;
+        while (end < entries.size() && entries[end].key == entries[begin].key)
+          ++end;
+        const uint32_t leader = entries[begin].voice;
+        const auto& src_leader = *m_mix_sources.find(m_voices.handle[leader]);
+        if (end - begin == 1)
+        {
+          leave_cluster(leader);
+          if (m_mix_listener_changed || m_voices.has(leader, VoiceTable::Dirty3D))
+            schedule_3d_update(leader, center_l);
+          continue;
+        }
+        
+        la::Vec3 centroid = la::Vec3_Zero;
+        la::Vec3 vel = la::Vec3_Zero;
+        float gain_sq = 0.f;
+        for (size_t i = begin; i < end; ++i)
+        {
+          const uint32_t v = entries[i].voice;
+          centroid += entries[i].center;
+          vel += m_mix_sources.find(m_voices.handle[v])->object_3d.get_channel_state(0)->vel_world;
+          const float gain = m_voices.gain[v] * m_voices.vol_gain[v];
+          gain_sq += gain * gain;
+          m_voices.set(v, VoiceTable::Clustered, i != begin);
+          m_voices.set(v, VoiceTable::ClusterLeader, i == begin);
+          m_voices.set(v, VoiceTable::Dirty3D, true);
+        }
+        const float num_members = static_cast<float>(end - begin);
+        centroid = centroid / num_members;
+        vel = vel / num_members;
+        m_voices.cluster_gain[leader] = std::sqrt(gain_sq);
+        
+        Source3D src_cluster = src_leader;
+        const la::Vec3 offset = centroid - entries[begin].center;
+        for (int ch = 0; ch < src_cluster.object_3d.num_channels(); ++ch)
+        {
+          auto* state = src_cluster.object_3d.get_channel_state(ch);
+          state->pos_world += offset;
+          state->vel_world = vel;
+        }
+        m_mix_scene_3d.add_source(src_cluster, m_mix_params_3d, leader);
       }
-      return false;
     }
     
   public:
@@ -424,11 +1414,178 @@ namespace applaudio
       return m_bits;
     }
 
+    // Time it takes for a sample mixed now to reach the speaker, i.e. device and
+    //   software buffering. Returns nullopt if the backend can't tell.
+    std::optional<float> get_output_latency() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (m_backend == nullptr || m_output_sample_rate <= 0)
+        return std::nullopt;
+      int frames = m_backend->get_latency_frames();
+      if (frames < 0)
+        return std::nullopt;
+      if (m_output_stage_type == OutputStageType::Limiter)
+        frames += OutputStage::limiter_lookahead_frames(m_output_sample_rate);
+      return static_cast<float>(frames) / m_output_sample_rate;
+    }
+    
+    // Voices are summed in float with headroom, and the output stage is the only place
+    //   where the mix is clipped or limited. Default is OutputStageType::HardClip.
+    void set_output_stage(OutputStageType type)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      m_output_stage_type = type;
+      push_or_coalesce_command({ .type = CommandType::SetOutputStage, .option = static_cast<int>(type) });
+    }
+    
+    OutputStageType get_output_stage() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_output_stage_type;
+    }
+    
+    // Resampler quality of all sources that don't set their own. Default is ResamplerQuality::Linear.
+    void set_resampler_quality(ResamplerQuality quality)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      m_resampler_quality = quality;
+      push_or_coalesce_command({ .type = CommandType::SetResamplerQuality, .option = static_cast<int>(quality) });
+    }
+    
+    ResamplerQuality get_resampler_quality() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_resampler_quality;
+    }
+    
+    // At most this many voices are mixed per block (0, the default, means no limit).
+    //   The rest are virtual: ranked by priority times gain (including 3D attenuation),
+    //   the least audible voices are not mixed but keep playing silently, and fade
+    //   back in where they would have been when they become audible enough again.
+    void set_max_real_voices(int max_voices)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      m_max_real_voices = std::max(max_voices, 0);
+      push_or_coalesce_command({ .type = CommandType::SetMaxRealVoices, .option = m_max_real_voices });
+    }
+    
+    int get_max_real_voices() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_max_real_voices;
+    }
+    
+    // Runs the 3D update (attenuation, panning, doppler and the audible radius test) only every
+    //   num_blocks blocks (1, the default, means every block). Gains and doppler ramp linearly
+    //   across each block, so updating less often smooths the motion rather than stepping it.
+    void set_3d_update_interval(int num_blocks)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      m_3d_update_interval = std::max(num_blocks, 1);
+      push_or_coalesce_command({ .type = CommandType::Set3DUpdateInterval, .option = m_3d_update_interval });
+    }
+    
+    int get_3d_update_interval() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_3d_update_interval;
+    }
+    
+    // Caps the number of sources whose 3D parameters are computed per full 3D update (0, the
+    //   default, means no limit), which bounds the cost of the 3D update however many sources
+    //   move. Sources due for an update are ranked by audibility, by how fast they move relative
+    //   to the listener for their distance, and by how long they have waited. Near and fast
+    //   sources then update every time while distant and slow ones take turns.
+    //   Sources that just started playing are always updated.
+    void set_3d_update_budget(int max_sources)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      m_3d_update_budget = std::max(max_sources, 0);
+      push_or_coalesce_command({ .type = CommandType::Set3DUpdateBudget, .option = m_3d_update_budget });
+    }
+    
+    int get_3d_update_budget() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_3d_update_budget;
+    }
+    
+    // Level of detail of 3D voices, picked every block from the voice's effective gain (gain times
+    //   3D attenuation, so distance counts): below reduced_below a voice is resampled with at most
+    //   ResamplerQuality::Cubic and its channels are mixed down to mono before the 3D panning,
+    //   below minimal_below it is also resampled linearly. Thresholds of 0 (the default) disable this.
+    void set_3d_lod_thresholds(float reduced_below, float minimal_below)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      m_lod_reduced_below = std::max(reduced_below, 0.f);
+      m_lod_minimal_below = std::clamp(minimal_below, 0.f, m_lod_reduced_below);
+      push_or_coalesce_command({ .type = CommandType::Set3DLodThresholds, .values = { m_lod_reduced_below, m_lod_minimal_below } });
+    }
+    
+    std::pair<float, float> get_3d_lod_thresholds() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return { m_lod_reduced_below, m_lod_minimal_below };
+    }
+    
+    // Clusterable sources (see set_source_clusterable()) that play the same buffer at the same pitch
+    //   and looping, are seen from the listener within about angle radians of each other and are at
+    //   about the same distance are mixed as one voice at their centroid, with the power sum of their
+    //   gains. Their cost then follows the number of distinct directions rather than the number of
+    //   sources. The cluster plays from its leader's position in the buffer, so the other members'
+    //   own play positions aren't heard while they are clustered.
+    //   Clusters are formed on every full 3D update. 0 (the default) disables clustering.
+    //   Positive angles below 1e-4 radians are raised to that.
+    void set_3d_cluster_angle(float angle)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (!std::isfinite(angle) || angle <= 0.f)
+        m_3d_cluster_angle = 0.f;
+      else
+        m_3d_cluster_angle = std::max(angle, c_min_3d_cluster_angle);
+      push_or_coalesce_command({ .type = CommandType::Set3DClusterAngle, .values = { m_3d_cluster_angle } });
+    }
+    
+    float get_3d_cluster_angle() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_3d_cluster_angle;
+    }
+    
+    // Number of playing voices that were not mixed in the last block.
+    int get_num_virtual_voices() const
+    {
+      return m_num_virtual_voices.load(std::memory_order_relaxed);
+    }
+    
+    // Number of blocks rendered so far and the wall time spent on them (applying commands,
+    //   updating the 3D scene and mixing). Take the difference between two calls for the cost per block.
+    struct RenderStats
+    {
+      uint64_t num_blocks = 0;
+      double render_time_ms = 0.0;
+    };
+    RenderStats get_render_stats() const
+    {
+      RenderStats stats;
+      stats.num_blocks = m_num_rendered_blocks.load(std::memory_order_acquire);
+      stats.render_time_ms = 1e-6 * static_cast<double>(m_render_time_ns.load(std::memory_order_relaxed));
+      return stats;
+    }
+    
+    // Bytes used by buffer copies at the output rate. See StartupOptions::resample_cache_budget_bytes.
+    size_t get_resample_cache_size() const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      return m_resample_cache_bytes;
+    }
+
     
     bool startup(int request_out_sample_rate = 48'000, 
                  int request_out_num_channels = 2, 
                  bool request_exclusive_mode_if_supported = false, 
-                 bool verbose = false)
+                 bool verbose = false,
+                 const StartupOptions& options = {})
     {
       std::scoped_lock lock(m_state_mutex);
       m_output_sample_rate = request_out_sample_rate;
@@ -440,6 +1597,20 @@ namespace applaudio
         return false;
       }
       
+      m_backend->set_startup_options(options);
+      
+      // Prefer letting the device clock pace the mixing.
+      if (options.pull_mode)
+        m_pull_mode = m_backend->set_render_callback([this](APL_SAMPLE_TYPE* data, size_t frames)
+        {
+          on_render_callback(data, frames);
+        });
+      else
+      {
+        m_backend->set_render_callback(nullptr);
+        m_pull_mode = false;
+      }
+      
       if (!m_backend->startup(m_output_sample_rate, m_output_channels, request_exclusive_mode_if_supported, verbose))
       {
         std::cerr << "AudioEngine: Failed to initialize backend!\n";
@@ -451,7 +1622,7 @@ namespace applaudio
       m_bits = m_backend->get_bit_format();
       
       // Query the backend for its preferred frame count
-      m_frame_count = m_backend->get_buffer_size_frames();
+      m_frame_count = m_backend->get_period_size_frames();
       
       if (m_frame_count <= 0)
       {
@@ -465,11 +1636,50 @@ namespace applaudio
           << "Fs_out = " << m_output_sample_rate << " Hz, "
           << "Bit format out: " << m_bits << " bits, "
           << m_output_channels << " output channels, "
-          << m_frame_count << " frames per mix\n";
+          << m_frame_count << " frames per mix, "
+          << (m_pull_mode ? "pull" : "push") << " mode\n";
       }
       
-      m_running = true;
-      m_thread = std::thread(&AudioEngine::enter_audio_thread_loop, this);
+      int num_mix_threads = options.num_mix_threads > 0 ?
+        options.num_mix_threads : static_cast<int>(std::thread::hardware_concurrency());
+      m_mix_workers.start(std::max(num_mix_threads, 1) - 1);
+      m_parallel_mix_min_voices = options.parallel_mix_min_voices;
+      m_output_stage.reset(m_output_channels, m_output_sample_rate);
+      mix_kernels::sinc_tables(); // Built here rather than on the mix thread.
+      
+      // The mix thread isn't running yet, so buffers set before startup can be converted in place.
+      m_resample_cache_budget = options.resample_cache_budget_bytes;
+      m_buffers.for_each([this](unsigned int, std::unique_ptr<Buffer>& buffer)
+      {
+        if (buffer->resampled_rate != m_output_sample_rate)
+        {
+          uncache_resampled(*buffer);
+          buffer->resampled.clear();
+          buffer->resampled.shrink_to_fit();
+          buffer->resampled_rate = 0;
+          cache_resampled(*buffer);
+        }
+      });
+      
+      m_mix_sources.reserve(std::max(options.max_sources, 0));
+      m_voices.reserve(std::max(options.max_sources, 0));
+      m_mix_params_3d.reserve(std::max(options.max_sources, 0));
+      m_mix_scene_3d.reserve(std::max(options.max_sources, 0));
+      m_mix_grid.reserve(std::max(options.max_sources, 0));
+      m_mix_grid.set_cell_size(options.spatial_grid_cell_size);
+      m_mix_cluster_entries.reserve(std::max(options.max_sources, 0));
+      m_mix_3d_candidates.reserve(std::max(options.max_sources, 0));
+      m_mix_buffers.reserve(std::max(options.max_buffers, 0));
+      m_mix_playing.reserve(std::max(options.max_sources, 0));
+      reserve_mix_state(m_frame_count, std::max(options.max_sources, 0), APL_MAX_CHANNELS);
+      
+      drain_commands();
+      m_running.store(true, std::memory_order_release);
+      if (!m_pull_mode)
+      {
+        m_mix_buffer.assign(m_frame_count * m_output_channels, static_cast<APL_SAMPLE_TYPE>(0));
+        m_thread = std::thread(&AudioEngine::enter_audio_thread_loop, this);
+      }
       
       return true;
     }
@@ -484,13 +1694,28 @@ namespace applaudio
       
       if (m_backend != nullptr)
         m_backend->shutdown();
+      
+      m_mix_workers.stop();
+      
+      // We're the consumer now, so nothing retired can be referenced anymore.
+      drain_commands();
+      m_retired.clear();
     }
 
     unsigned int create_source()
     {
       std::scoped_lock lock(m_state_mutex);
-      unsigned int id = m_next_source_id++;
-      m_sources[id] = Source {};
+      auto status = std::make_unique<SourceStatus>();
+      Source src;
+      src.status = status.get();
+      unsigned int id = m_sources.insert(src);
+      if (id == 0)
+      {
+        std::cerr << "ERROR: Out of source slots!" << std::endl;
+        return 0;
+      }
+      push_command({ .type = CommandType::CreateSource, .id = id, .status = status.get() });
+      m_source_statuses.emplace_at(id, std::move(status));
       return id;
     }
     
@@ -502,20 +1727,37 @@ namespace applaudio
     void destroy_source(unsigned int src_id)
     {
       std::scoped_lock lock(m_state_mutex);
-      m_sources.erase(src_id);
+      if (!m_sources.erase(src_id))
+        return;
+      auto ticket = push_command({ .type = CommandType::DestroySource, .id = src_id });
+      retire(ticket, std::move(*m_source_statuses.find(src_id)));
+      m_source_statuses.erase(src_id);
     }
     
     unsigned int create_buffer()
     {
       std::scoped_lock lock(m_state_mutex);
-      unsigned int id = m_next_buffer_id++;
-      m_buffers[id] = Buffer {};
+      auto buffer = std::make_unique<Buffer>();
+      const Buffer* buffer_ptr = buffer.get();
+      unsigned int id = m_buffers.insert(std::move(buffer));
+      if (id == 0)
+      {
+        std::cerr << "ERROR: Out of buffer slots!" << std::endl;
+        return 0;
+      }
+      push_command({ .type = CommandType::SetBufferData, .id = id, .buffer = buffer_ptr });
       return id;
     }
     
     void destroy_buffer(unsigned int buf_id)
     {
       std::scoped_lock lock(m_state_mutex);
+      auto* buf_slot = m_buffers.find(buf_id);
+      if (buf_slot == nullptr)
+        return;
+      auto ticket = push_command({ .type = CommandType::DestroyBuffer, .id = buf_id });
+      uncache_resampled(**buf_slot);
+      retire(ticket, std::move(*buf_slot));
       m_buffers.erase(buf_id);
     }
     
@@ -523,12 +1765,14 @@ namespace applaudio
                             int channels, int sample_rate)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto buf_it = m_buffers.find(buf_id);
-      if (buf_it != m_buffers.end())
+      auto* buf_slot = m_buffers.find(buf_id);
+      if (buf_slot != nullptr && check_num_channels(channels))
       {
-        convert_8u(buf_it->second.data, data);
-        buf_it->second.channels = channels;
-        buf_it->second.sample_rate = sample_rate;
+        auto buffer = std::make_unique<Buffer>();
+        convert_8u(buffer->data, data);
+        buffer->channels = channels;
+        buffer->sample_rate = sample_rate;
+        publish_buffer(buf_id, *buf_slot, std::move(buffer));
         return true;
       }
       return false;
@@ -538,12 +1782,14 @@ namespace applaudio
                             int channels, int sample_rate)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto buf_it = m_buffers.find(buf_id);
-      if (buf_it != m_buffers.end())
+      auto* buf_slot = m_buffers.find(buf_id);
+      if (buf_slot != nullptr && check_num_channels(channels))
       {
-        convert_8s(buf_it->second.data, data);
-        buf_it->second.channels = channels;
-        buf_it->second.sample_rate = sample_rate;
+        auto buffer = std::make_unique<Buffer>();
+        convert_8s(buffer->data, data);
+        buffer->channels = channels;
+        buffer->sample_rate = sample_rate;
+        publish_buffer(buf_id, *buf_slot, std::move(buffer));
         return true;
       }
       return false;
@@ -553,12 +1799,14 @@ namespace applaudio
                              int channels, int sample_rate)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto buf_it = m_buffers.find(buf_id);
-      if (buf_it != m_buffers.end())
+      auto* buf_slot = m_buffers.find(buf_id);
+      if (buf_slot != nullptr && check_num_channels(channels))
       {
-        convert_16s(buf_it->second.data, data);
-        buf_it->second.channels = channels;
-        buf_it->second.sample_rate = sample_rate;
+        auto buffer = std::make_unique<Buffer>();
+        convert_16s(buffer->data, data);
+        buffer->channels = channels;
+        buffer->sample_rate = sample_rate;
+        publish_buffer(buf_id, *buf_slot, std::move(buffer));
         return true;
       }
       return false;
@@ -568,12 +1816,14 @@ namespace applaudio
                              int channels, int sample_rate)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto buf_it = m_buffers.find(buf_id);
-      if (buf_it != m_buffers.end())
+      auto* buf_slot = m_buffers.find(buf_id);
+      if (buf_slot != nullptr && check_num_channels(channels))
       {
-        convert_32f(buf_it->second.data, data);
-        buf_it->second.channels = channels;
-        buf_it->second.sample_rate = sample_rate;
+        auto buffer = std::make_unique<Buffer>();
+        convert_32f(buffer->data, data);
+        buffer->channels = channels;
+        buffer->sample_rate = sample_rate;
+        publish_buffer(buf_id, *buf_slot, std::move(buffer));
         return true;
       }
       return false;
@@ -582,14 +1832,13 @@ namespace applaudio
     bool attach_buffer_to_source(unsigned int src_id, unsigned int buf_id)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto src_it = m_sources.find(src_id);
-      if (src_it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        Source& src = src_it->second;
+        Source& src = *src_ptr;
         src.buffer_id = buf_id;
         src.playing = false; // Stop playback
-        src.play_pos = 0.0; // Reset position
         src.paused = false;
+        push_command({ .type = CommandType::AttachBuffer, .id = src_id, .arg = buf_id });
         return true;
       }
       return false;
@@ -601,14 +1850,13 @@ namespace applaudio
     bool detach_buffer_from_source(unsigned int src_id)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto src_it = m_sources.find(src_id);
-      if (src_it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        Source& src = src_it->second;
+        Source& src = *src_ptr;
         src.buffer_id = 0; // Detach by setting buffer_id to 0
         src.playing = false; // Stop playback
-        src.play_pos = 0.0; // Reset position
         src.paused = false;
+        push_command({ .type = CommandType::DetachBuffer, .id = src_id });
         return true;
       }
       return false;
@@ -618,13 +1866,12 @@ namespace applaudio
     void play_source(unsigned int src_id)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        Source& src = it->second;
+        Source& src = *src_ptr;
         src.playing = true;
-        if (!src.paused)
-          src.play_pos = 0.0;
+        src.play_id = m_next_play_id++;
+        push_command({ .type = CommandType::PlaySource, .id = src_id, .arg = src.play_id, .flag = src.paused });
         src.paused = false;
       }
     }
@@ -633,9 +1880,8 @@ namespace applaudio
     std::optional<bool> is_source_playing(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        return it->second.playing;
+      if (auto* src = m_sources.find(src_id))
+        return is_playing(*src);
       return std::nullopt;
     }
     
@@ -643,21 +1889,20 @@ namespace applaudio
     void pause_source(unsigned int src_id)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        Source& src = it->second;
+        Source& src = *src_ptr;
         src.playing = false;
         src.paused = true;
+        push_command({ .type = CommandType::PauseSource, .id = src_id });
       }
     }
     
     std::optional<bool> is_source_paused(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        return it->second.paused;
+      if (auto* src = m_sources.find(src_id))
+        return src->paused;
       return std::nullopt;
     }
     
@@ -665,13 +1910,12 @@ namespace applaudio
     void stop_source(unsigned int src_id)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        Source& src = it->second;
+        Source& src = *src_ptr;
         src.playing = false;
         src.paused = false;
-        src.play_pos = 0.0;
+        push_command({ .type = CommandType::StopSource, .id = src_id });
       }
     }
     
@@ -679,38 +1923,38 @@ namespace applaudio
     void set_source_gain(unsigned int src_id, float gain)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        it->second.gain = gain;
+      if (auto* src = m_sources.find(src_id))
+      {
+        src->gain = gain;
+        push_or_coalesce_command({ .type = CommandType::SetSourceGain, .id = src_id, .values = { gain } });
+      }
     }
     
     std::optional<float> get_source_gain(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        return it->second.gain;
+      if (auto* src = m_sources.find(src_id))
+        return src->gain;
       return std::nullopt;
     }
     
     void set_source_volume_dB(unsigned int src_id, float vol_dB)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src = m_sources.find(src_id))
       {
         float gain = std::pow(10.f, vol_dB/20.f);
-        it->second.vol_gain = gain;
+        src->vol_gain = gain;
+        push_or_coalesce_command({ .type = CommandType::SetSourceVolumeGain, .id = src_id, .values = { gain } });
       }
     }
     
     std::optional<float> get_source_volume_dB(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src = m_sources.find(src_id))
       {
-        float vol_dB = 20.f * std::log10(it->second.vol_gain);
+        float vol_dB = 20.f * std::log10(src->vol_gain);
         return vol_dB;
       }
       return std::nullopt;
@@ -743,17 +1987,18 @@ namespace applaudio
     void set_source_pitch(unsigned int src_id, float pitch)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        it->second.pitch = pitch;
+      if (auto* src = m_sources.find(src_id))
+      {
+        src->pitch = pitch;
+        push_or_coalesce_command({ .type = CommandType::SetSourcePitch, .id = src_id, .values = { pitch } });
+      }
     }
     
     std::optional<float> get_source_pitch(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        return it->second.pitch;
+      if (auto* src = m_sources.find(src_id))
+        return src->pitch;
       return std::nullopt;
     }
     
@@ -761,39 +2006,82 @@ namespace applaudio
     void set_source_looping(unsigned int src_id, bool loop)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        it->second.looping = loop;
+      if (auto* src = m_sources.find(src_id))
+      {
+        src->looping = loop;
+        push_or_coalesce_command({ .type = CommandType::SetSourceLooping, .id = src_id, .flag = loop });
+      }
     }
     
     std::optional<bool> get_source_looping(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        return it->second.looping;
+      if (auto* src = m_sources.find(src_id))
+        return src->looping;
       return std::nullopt;
     }
     
     void set_source_panning(unsigned int src_id, std::optional<float> pan = std::nullopt)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.pan = std::nullopt; // Could be tad faster than an else below.
         if (pan.has_value())
           src.pan = std::clamp(pan.value(), 0.f, 1.f);
+        push_or_coalesce_command({ .type = CommandType::SetSourcePanning, .id = src_id,
+                                   .flag = src.pan.has_value(), .values = { src.pan.value_or(0.f) } });
       }
     }
     
     std::optional<float> get_source_panning(unsigned int src_id) const
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        return it->second.pan;
+      if (auto* src = m_sources.find(src_id))
+        return src->pan;
+      return std::nullopt;
+    }
+    
+    // Scales the audibility the source is ranked by when there are more voices than set_max_real_voices().
+    //   Default is 1. A priority of 0 makes the source the first to go virtual.
+    void set_source_priority(unsigned int src_id, float priority)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (auto* src = m_sources.find(src_id))
+      {
+        src->priority = std::max(priority, 0.f);
+        push_or_coalesce_command({ .type = CommandType::SetSourcePriority, .id = src_id, .values = { src->priority } });
+      }
+    }
+    
+    std::optional<float> get_source_priority(unsigned int src_id) const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (auto* src = m_sources.find(src_id))
+        return src->priority;
+      return std::nullopt;
+    }
+    
+    // Overrides the engine wide resampler quality for this source. nullopt reverts to the engine default.
+    void set_source_resampler_quality(unsigned int src_id, std::optional<ResamplerQuality> quality = std::nullopt)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (auto* src = m_sources.find(src_id))
+      {
+        src->resampler_quality = quality;
+        push_or_coalesce_command({ .type = CommandType::SetSourceResamplerQuality, .id = src_id,
+                                   .option = static_cast<int>(quality.value_or(ResamplerQuality::Linear)),
+                                   .flag = quality.has_value() });
+      }
+    }
+    
+    // Quality the source is mixed with, i.e. the engine default unless overridden.
+    std::optional<ResamplerQuality> get_source_resampler_quality(unsigned int src_id) const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (auto* src = m_sources.find(src_id))
+        return src->resampler_quality.value_or(m_resampler_quality);
       return std::nullopt;
     }
     
@@ -814,14 +2102,17 @@ namespace applaudio
         return;
       scene_3d = std::make_unique<a3d::PositionalAudio>();
       listener.object_3d.set_num_channels(m_output_channels);
+      push_command({ .type = CommandType::Init3DScene, .num_channels = m_output_channels });
     }
     
     void enable_source_3d_audio(unsigned int src_id, bool enable)
     {
       std::scoped_lock lock(m_state_mutex);
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
-        it->second.object_3d.enable_3d_audio(enable);
+      if (auto* src = m_sources.find(src_id))
+      {
+        src->object_3d.enable_3d_audio(enable);
+        push_or_coalesce_command({ .type = CommandType::EnableSource3D, .id = src_id, .flag = enable });
+      }
     }
     
     bool set_source_3d_state_channel(unsigned int src_id, int channel, const la::Mtx3& rot_mtx,
@@ -830,18 +2121,18 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        auto buf_it = m_buffers.find(src.buffer_id);
-        if (buf_it == m_buffers.end())
+        auto& src = *src_ptr;
+        auto* buf_slot = m_buffers.find(src.buffer_id);
+        if (buf_slot == nullptr)
           return false;
-        if (src.object_3d.num_channels() != buf_it->second.channels)
-          src.object_3d.set_num_channels(buf_it->second.channels);
+        if (src.object_3d.num_channels() != (*buf_slot)->channels)
+          src.object_3d.set_num_channels((*buf_slot)->channels);
         if (channel < 0 || channel >= src.object_3d.num_channels())
           return false;
         src.object_3d.set_channel_state(channel, rot_mtx, pos_world, vel_world);
+        push_source_3d_state_channel(src_id, src, channel);
         return true;
       }
       return false;
@@ -853,12 +2144,11 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        auto buf_it = m_buffers.find(src.buffer_id);
-        if (buf_it == m_buffers.end())
+        auto& src = *src_ptr;
+        auto* buf_slot = m_buffers.find(src.buffer_id);
+        if (buf_slot == nullptr)
           return false;
         if (channel < 0 || channel >= src.object_3d.num_channels())
           return false;
@@ -876,15 +2166,14 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        auto buf_it = m_buffers.find(src.buffer_id);
-        if (buf_it == m_buffers.end())
+        auto& src = *src_ptr;
+        auto* buf_slot = m_buffers.find(src.buffer_id);
+        if (buf_slot == nullptr)
           return false;
-        if (src.object_3d.num_channels() != buf_it->second.channels)
-          src.object_3d.set_num_channels(buf_it->second.channels);
+        if (src.object_3d.num_channels() != (*buf_slot)->channels)
+          src.object_3d.set_num_channels((*buf_slot)->channels);
         if (static_cast<int>(channel_pos_offsets_local.size()) != src.object_3d.num_channels())
         {
           std::cerr << "ERROR in set_source_3d_state() : number of channel_pos_offsets_local positions do not match the number of channels registered in the source." << std::endl;
@@ -899,6 +2188,7 @@ namespace applaudio
           trf.get_column_vec(la::W, world_pos_cm);
           auto world_vel_ch = vel_world + la::cross(world_ang_vel, world_pos_ch - world_pos_cm);
           src.object_3d.set_channel_state(ch, trf.get_rot_matrix(), world_pos_ch, world_vel_ch);
+          push_source_3d_state_channel(src_id, src, ch);
         }
         return true;
       }
@@ -914,6 +2204,7 @@ namespace applaudio
       if (channel < 0 || channel >= listener.object_3d.num_channels())
         return false;
       listener.object_3d.set_channel_state(channel, rot_mtx, pos_world, vel_world);
+      push_listener_3d_state_channel(channel);
       return true;
     }
     
@@ -951,6 +2242,7 @@ namespace applaudio
         trf.get_column_vec(la::W, world_pos_cm);
         auto world_vel_ch = vel_world + la::cross(world_ang_vel, world_pos_ch - world_pos_cm);
         listener.object_3d.set_channel_state(ch, trf.get_rot_matrix(), world_pos_ch, world_vel_ch);
+        push_listener_3d_state_channel(ch);
       }
       return true;
     }
@@ -960,11 +2252,11 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.speed_of_sound = speed_of_sound;
+        push_or_coalesce_command({ .type = CommandType::SetSourceSpeedOfSound, .id = src_id, .values = { speed_of_sound } });
         return true;
       }
       return false;
@@ -975,10 +2267,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        const auto& src = it->second;
+        const auto& src = *src_ptr;
         return src.speed_of_sound;
       }
       return std::nullopt;
@@ -989,11 +2280,12 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        return scene_3d->set_attenuation_min_distance(src, min_dist);
+        auto& src = *src_ptr;
+        bool ok = scene_3d->set_attenuation_min_distance(src, min_dist);
+        push_source_attenuation(src_id, src);
+        return ok;
       }
       return false;
     }
@@ -1003,10 +2295,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return scene_3d->get_attenuation_min_distance(src);
       }
       return std::nullopt;
@@ -1017,11 +2308,12 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        return scene_3d->set_attenuation_max_distance(src, max_dist);
+        auto& src = *src_ptr;
+        bool ok = scene_3d->set_attenuation_max_distance(src, max_dist);
+        push_source_attenuation(src_id, src);
+        return ok;
       }
       return false;
     }
@@ -1031,10 +2323,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return scene_3d->get_attenuation_max_distance(src);
       }
       return std::nullopt;
@@ -1045,11 +2336,12 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        return scene_3d->set_attenuation_constant_falloff(src, const_falloff);
+        auto& src = *src_ptr;
+        bool ok = scene_3d->set_attenuation_constant_falloff(src, const_falloff);
+        push_source_attenuation(src_id, src);
+        return ok;
       }
       return false;
     }
@@ -1059,10 +2351,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return scene_3d->get_attenuation_constant_falloff(src);
       }
       return std::nullopt;
@@ -1073,11 +2364,12 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        return scene_3d->set_attenuation_linear_falloff(src, lin_falloff);
+        auto& src = *src_ptr;
+        bool ok = scene_3d->set_attenuation_linear_falloff(src, lin_falloff);
+        push_source_attenuation(src_id, src);
+        return ok;
       }
       return false;
     }
@@ -1087,10 +2379,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return scene_3d->get_attenuation_linear_falloff(src);
       }
       return std::nullopt;
@@ -1101,11 +2392,12 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
-        return scene_3d->set_attenuation_quadratic_falloff(src, sq_falloff);
+        auto& src = *src_ptr;
+        bool ok = scene_3d->set_attenuation_quadratic_falloff(src, sq_falloff);
+        push_source_attenuation(src_id, src);
+        return ok;
       }
       return false;
     }
@@ -1115,10 +2407,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return scene_3d->get_attenuation_quadratic_falloff(src);
       }
       return std::nullopt;
@@ -1132,11 +2423,11 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.directivity_alpha = std::clamp(directivity_alpha, 0.f, 1.f);
+        push_or_coalesce_command({ .type = CommandType::SetSourceDirectivityAlpha, .id = src_id, .values = { src.directivity_alpha } });
         return true;
       }
       return false;
@@ -1150,10 +2441,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return src.directivity_alpha;
       }
       return std::nullopt;
@@ -1165,11 +2455,11 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.directivity_sharpness = std::clamp(directivity_sharpness, 1.f, 8.f);
+        push_or_coalesce_command({ .type = CommandType::SetSourceDirectivitySharpness, .id = src_id, .values = { src.directivity_sharpness } });
         return true;
       }
       return false;
@@ -1181,10 +2471,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return src.directivity_sharpness;
       }
       return std::nullopt;
@@ -1196,11 +2485,11 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.directivity_type = directivity_type;
+        push_or_coalesce_command({ .type = CommandType::SetSourceDirectivityType, .id = src_id, .option = static_cast<int>(directivity_type) });
         return true;
       }
       return false;
@@ -1212,26 +2501,85 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return src.directivity_type;
       }
       return std::nullopt;
     }
     
+    // Beyond this distance between its emitters and the listener's ears the source is virtual,
+    //   and costs neither 3D updates nor mixing. 0 = No limit.
+    bool set_source_audible_radius(unsigned int src_id, float radius)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (scene_3d == nullptr)
+        return false;
+      if (auto* src_ptr = m_sources.find(src_id))
+      {
+        auto& src = *src_ptr;
+        src.audible_radius = std::isfinite(radius) ? std::max(radius, 0.f) : 0.f;
+        push_or_coalesce_command({ .type = CommandType::SetSourceAudibleRadius, .id = src_id, .values = { src.audible_radius } });
+        return true;
+      }
+      return false;
+    }
+    
+    std::optional<float> get_source_audible_radius(unsigned int src_id) const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (scene_3d == nullptr)
+        return std::nullopt;
+      if (auto* src_ptr = m_sources.find(src_id))
+      {
+        auto& src = *src_ptr;
+        return src.audible_radius;
+      }
+      return std::nullopt;
+    }
+    
+    // A clusterable source may be mixed together with other clusterable sources that play the
+    //   same buffer the same way and are heard from about the same direction and distance, see set_3d_cluster_angle().
+    bool set_source_clusterable(unsigned int src_id, bool clusterable)
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (scene_3d == nullptr)
+        return false;
+      if (auto* src_ptr = m_sources.find(src_id))
+      {
+        auto& src = *src_ptr;
+        src.clusterable = clusterable;
+        push_or_coalesce_command({ .type = CommandType::SetSourceClusterable, .id = src_id, .flag = clusterable });
+        return true;
+      }
+      return false;
+    }
+    
+    std::optional<bool> get_source_clusterable(unsigned int src_id) const
+    {
+      std::scoped_lock lock(m_state_mutex);
+      if (scene_3d == nullptr)
+        return std::nullopt;
+      if (auto* src_ptr = m_sources.find(src_id))
+      {
+        auto& src = *src_ptr;
+        return src.clusterable;
+      }
+      return std::nullopt;
+    }
+    
     // [0.f, 1.f]. 0 = Silence, 1 = No Attenuation.
     bool set_source_rear_attenuation(unsigned int src_id, float rear_attenuation)
     {
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.rear_attenuation = std::clamp(rear_attenuation, 0.f, 1.f);
+        push_or_coalesce_command({ .type = CommandType::SetSourceRearAttenuation, .id = src_id, .values = { src.rear_attenuation } });
         return true;
       }
       return false;
@@ -1243,10 +2591,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return std::nullopt;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return src.rear_attenuation;
       }
       return std::nullopt;
@@ -1259,6 +2606,7 @@ namespace applaudio
       if (scene_3d == nullptr)
         return false;
       listener.rear_attenuation = std::clamp(rear_attenuation, 0.f, 1.f);
+      push_or_coalesce_command({ .type = CommandType::SetListenerRearAttenuation, .values = { listener.rear_attenuation } });
       return true;
     }
     
@@ -1276,11 +2624,11 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return false;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         src.object_3d.set_coordsys_convention(cs_conv);
+        push_or_coalesce_command({ .type = CommandType::SetSourceCoordSys, .id = src_id, .option = static_cast<int>(cs_conv) });
         return true;
       }
       return false;
@@ -1291,10 +2639,9 @@ namespace applaudio
       std::scoped_lock lock(m_state_mutex);
       if (scene_3d == nullptr)
         return a3d::CoordSysConvention::RH_XLeft_YUp_ZForward;
-      auto it = m_sources.find(src_id);
-      if (it != m_sources.end())
+      if (auto* src_ptr = m_sources.find(src_id))
       {
-        auto& src = it->second;
+        auto& src = *src_ptr;
         return src.object_3d.get_coordsys_convention();
       }
       return std::nullopt;
@@ -1306,6 +2653,7 @@ namespace applaudio
       if (scene_3d == nullptr)
         return false;
       listener.object_3d.set_coordsys_convention(cs_conv);
+      push_or_coalesce_command({ .type = CommandType::SetListenerCoordSys, .option = static_cast<int>(cs_conv) });
       return true;
     }
     
@@ -7,17 +7,17 @@
 
 #pragma once
 #include "IBackend.h"
+#include "RingBuffer.h"
 
 #ifdef __linux__
 
 #include <alsa/asoundlib.h>
 #include <thread>
-#include <mutex>
 #include <atomic>
 #include <vector>
 #include <iostream>
-#include <cstring>
-#include <condition_variable>
+#include <chrono>
+#include <algorithm>
 
 namespace applaudio
 {
@@ -50,8 +50,16 @@ namespace applaudio
         return false;
       }
       
-      // Set access type
-      if ((err = snd_pcm_hw_params_set_access(m_pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+      // Set access type. In pull mode we can optionally mix straight into the mmapped device buffer.
+      m_use_mmap = false;
+      if (m_options.use_mmap && m_render_callback)
+      {
+        if (snd_pcm_hw_params_set_access(m_pcm_handle, hw_params, SND_PCM_ACCESS_MMAP_INTERLEAVED) >= 0)
+          m_use_mmap = true;
+        else if (verbose)
+          std::cout << "ALSA: device refused mmap access, falling back to read/write access." << std::endl;
+      }
+      if (!m_use_mmap && (err = snd_pcm_hw_params_set_access(m_pcm_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
       {
         std::cerr << "ALSA: cannot set access type: " << snd_strerror(err) << std::endl;
         return false;
@@ -84,11 +92,11 @@ namespace applaudio
         return false;
       }
       
-      // Set buffer size (2 periods of 1024 frames each)
-      snd_pcm_uframes_t buffer_size = 2048;
-      snd_pcm_uframes_t period_size = 1024;
-      if ((err = snd_pcm_hw_params_set_buffer_size_near(m_pcm_handle, hw_params, &buffer_size)) < 0 ||
-          (err = snd_pcm_hw_params_set_period_size_near(m_pcm_handle, hw_params, &period_size, 0)) < 0)
+      // Set period size and count (default: 2 periods of 1024 frames each).
+      snd_pcm_uframes_t period_size = m_options.period_size_frames > 0 ? m_options.period_size_frames : 1024;
+      unsigned int num_periods = m_options.num_periods > 0 ? m_options.num_periods : 2;
+      if ((err = snd_pcm_hw_params_set_period_size_near(m_pcm_handle, hw_params, &period_size, 0)) < 0 ||
+          (err = snd_pcm_hw_params_set_periods_near(m_pcm_handle, hw_params, &num_periods, 0)) < 0)
       {
         std::cerr << "ALSA: cannot set buffer/period size: " << snd_strerror(err) << std::endl;
         return false;
@@ -105,6 +113,25 @@ namespace applaudio
       m_channels = request_channels;
       m_bits = snd_pcm_format_physical_width(format);
       
+      snd_pcm_uframes_t actual_buffer_size = 0;
+      snd_pcm_get_params(m_pcm_handle, &actual_buffer_size, &m_period_size);
+      
+      // Wake up once per period and start the device once the buffer has been primed.
+      snd_pcm_sw_params_t* sw_params;
+      snd_pcm_sw_params_alloca(&sw_params);
+      if ((err = snd_pcm_sw_params_current(m_pcm_handle, sw_params)) < 0 ||
+          (err = snd_pcm_sw_params_set_avail_min(m_pcm_handle, sw_params, m_period_size)) < 0 ||
+          (err = snd_pcm_sw_params_set_start_threshold(m_pcm_handle, sw_params, actual_buffer_size)) < 0 ||
+          (err = snd_pcm_sw_params(m_pcm_handle, sw_params)) < 0)
+      {
+        std::cerr << "ALSA: cannot set sw parameters: " << snd_strerror(err) << std::endl;
+        return false;
+      }
+      
+      if (verbose)
+        std::cout << "ALSA: " << m_period_size << " frames per period, "
+                  << actual_buffer_size << " frames device buffer." << std::endl;
+      
       // Prepare PCM
       if ((err = snd_pcm_prepare(m_pcm_handle)) < 0)
       {
@@ -112,13 +139,20 @@ namespace applaudio
         return false;
       }
       
-      // Initialize ring buffer (4 seconds)
-      size_t buffer_samples = m_sample_rate * m_channels * 4;
-      m_ring_buffer.resize(buffer_samples);
-      std::fill(m_ring_buffer.begin(), m_ring_buffer.end(), 0);
-      
+      m_device_delay = 0;
       m_running = true;
-      m_render_thread = std::thread(&Backend_Linux_ALSA::render_loop, this);
+      if (m_render_callback)
+      {
+        // Pull mode: the device wakes us up and we render straight into it.
+        m_render_thread = std::thread(&Backend_Linux_ALSA::pull_loop, this);
+      }
+      else
+      {
+        // Matches the device buffer, so push mode adds at most one device buffer of latency.
+        m_ring_buffer.reset(std::max<snd_pcm_uframes_t>(actual_buffer_size, 1), m_channels);
+        
+        m_render_thread = std::thread(&Backend_Linux_ALSA::render_loop, this);
+      }
       
       return true;
     }
@@ -126,7 +160,6 @@ namespace applaudio
     virtual void shutdown() override
     {
       m_running = false;
-      m_buffer_cv.notify_all(); // Wake up render thread
       
       if (m_render_thread.joinable())
         m_render_thread.join();
@@ -144,29 +177,8 @@ namespace applaudio
       if (m_pcm_handle == nullptr)
         return false;
       
-      std::unique_lock<std::mutex> lock(m_buffer_mutex);
-      
-      size_t samples_to_write = frames * m_channels;
-      size_t available_space = (m_read_pos > m_write_pos) ?
-      (m_read_pos - m_write_pos - 1) :
-      (m_ring_buffer.size() - m_write_pos + m_read_pos - 1);
-      
-      if (samples_to_write > available_space)
-      {
-        // Buffer overrun - skip some samples
-        samples_to_write = available_space;
-      }
-      
-      for (size_t i = 0; i < samples_to_write; ++i)
-      {
-        m_ring_buffer[m_write_pos] = data[i];
-        m_write_pos = (m_write_pos + 1) % m_ring_buffer.size();
-      }
-      
-      lock.unlock();
-      m_buffer_cv.notify_one(); // Notify render thread
-      
-      return samples_to_write == frames * m_channels;
+      // Buffer overrun - whatever doesn't fit is skipped.
+      return m_ring_buffer.write(data, frames) == frames;
     }
     
     virtual int get_sample_rate() const override { return m_sample_rate; }
@@ -183,58 +195,147 @@ namespace applaudio
       return static_cast<int>(buffer_size);
     }
     
+    virtual int get_period_size_frames() const override { return static_cast<int>(m_period_size); }
+    
+    // Device delay as of the last transfer plus whatever waits in the software ring.
+    virtual int get_latency_frames() const override
+    {
+      if (m_pcm_handle == nullptr)
+        return -1;
+      int delay = m_device_delay.load(std::memory_order_relaxed);
+      if (delay >= 0 && !m_render_callback)
+        delay += static_cast<int>(m_ring_buffer.available_read());
+      return delay;
+    }
+    
     virtual std::string backend_name() const override { return "Linux : ALSA"; }
     
+    virtual bool set_render_callback(RenderCallback callback) override
+    {
+      m_render_callback = std::move(callback);
+      return true;
+    }
+    
+    virtual void set_startup_options(const StartupOptions& options) override
+    {
+      m_options = options;
+    }
+    
   private:
-    void render_loop()
+    void pull_loop()
     {
-      const size_t frames_per_chunk = 512;
-      std::vector<APL_SAMPLE_TYPE> temp_buffer(frames_per_chunk * m_channels);
+      const snd_pcm_uframes_t frames_per_chunk = std::max<snd_pcm_uframes_t>(m_period_size, 1);
+      std::vector<APL_SAMPLE_TYPE> period_buffer(m_use_mmap ? 0 : frames_per_chunk * m_channels);
       
       while (m_running)
       {
+        // Block until there is room for at least one period (avail_min) in the device buffer.
+        int err = snd_pcm_wait(m_pcm_handle, 100);
+        if (err < 0)
         {
-          std::unique_lock<std::mutex> lock(m_buffer_mutex);
-          
-          // Wait for data if buffer is empty
-          if (m_read_pos == m_write_pos)
-          {
-            m_buffer_cv.wait_for(lock, std::chrono::milliseconds(100),
-                                 [this]() { return m_read_pos != m_write_pos || !m_running; });
-            
-            if (!m_running) break;
-            if (m_read_pos == m_write_pos) continue; // Still no data
-          }
-          
-          // Copy data from ring buffer
-          for (size_t i = 0; i < temp_buffer.size(); ++i)
-          {
-            if (m_read_pos != m_write_pos)
-            {
-              temp_buffer[i] = m_ring_buffer[m_read_pos];
-              m_read_pos = (m_read_pos + 1) % m_ring_buffer.size();
-            }
-            else
-            {
-              // Buffer underrun - fill with silence
-              temp_buffer[i] = static_cast<APL_SAMPLE_TYPE>(0);
-            }
-          }
+          recover(err);
+          continue;
         }
+        if (err == 0)
+          continue; // Timeout.
         
-        // Write to ALSA
-        snd_pcm_sframes_t written = snd_pcm_writei(m_pcm_handle, temp_buffer.data(), frames_per_chunk);
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(m_pcm_handle);
+        if (avail < 0)
+        {
+          recover(static_cast<int>(avail));
+          continue;
+        }
         
-        if (written == -EPIPE)
+        // Render whole periods only so that the engine always mixes the same block size.
+        bool ok = true;
+        while (m_running && avail >= static_cast<snd_pcm_sframes_t>(frames_per_chunk))
         {
-          // Underrun occurred
-          snd_pcm_prepare(m_pcm_handle);
+          snd_pcm_sframes_t written = m_use_mmap ?
+            render_mmap(frames_per_chunk) :
+            render_rw(period_buffer.data(), frames_per_chunk);
+          if (written < 0)
+          {
+            recover(static_cast<int>(written));
+            ok = false;
+            break;
+          }
+          avail -= written;
         }
-        else if (written < 0)
+        update_device_delay();
+        
+        // mmap commits don't start the stream, so start it once the buffer has been primed.
+        if (ok && m_use_mmap && snd_pcm_state(m_pcm_handle) == SND_PCM_STATE_PREPARED)
+          snd_pcm_start(m_pcm_handle);
+      }
+    }
+    
+    snd_pcm_sframes_t render_rw(APL_SAMPLE_TYPE* period_buffer, snd_pcm_uframes_t frames)
+    {
+      m_render_callback(period_buffer, frames);
+      return snd_pcm_writei(m_pcm_handle, period_buffer, frames);
+    }
+    
+    // Zero-copy: the engine mixes directly into the device buffer.
+    snd_pcm_sframes_t render_mmap(snd_pcm_uframes_t frames)
+    {
+      const snd_pcm_channel_area_t* areas = nullptr;
+      snd_pcm_uframes_t offset = 0;
+      int err = snd_pcm_mmap_begin(m_pcm_handle, &areas, &offset, &frames);
+      if (err < 0)
+        return err;
+      
+      // Interleaved, so all channels share the first area.
+      auto* data = reinterpret_cast<APL_SAMPLE_TYPE*>(static_cast<unsigned char*>(areas[0].addr)
+                                                      + (areas[0].first + offset * areas[0].step) / 8);
+      m_render_callback(data, frames);
+      
+      snd_pcm_sframes_t committed = snd_pcm_mmap_commit(m_pcm_handle, offset, frames);
+      if (committed >= 0 && static_cast<snd_pcm_uframes_t>(committed) != frames)
+        return -EPIPE;
+      return committed;
+    }
+    
+    // Only called from the I/O thread so that the PCM handle is never shared between threads.
+    void update_device_delay()
+    {
+      snd_pcm_sframes_t delay = 0;
+      if (snd_pcm_delay(m_pcm_handle, &delay) < 0)
+        delay = -1; // E.g. during an underrun.
+      m_device_delay.store(static_cast<int>(delay), std::memory_order_relaxed);
+    }
+    
+    void recover(int err)
+    {
+      if (err != -EPIPE) // Underruns are recovered silently.
+        std::cerr << "ALSA: write error: " << snd_strerror(err) << std::endl;
+      snd_pcm_recover(m_pcm_handle, err, 1);
+    }
+    
+    void render_loop()
+    {
+      const size_t frames_per_chunk = std::max<snd_pcm_uframes_t>(m_period_size, 1);
+      const auto poll_interval = std::chrono::microseconds(250'000 * frames_per_chunk / std::max(m_sample_rate, 1));
+      
+      while (m_running)
+      {
+        // Hand the readable segment straight to ALSA. snd_pcm_writei() blocks until
+        //   the device has room, which is what paces this loop.
+        const APL_SAMPLE_TYPE* data = nullptr;
+        size_t frames = m_ring_buffer.peek(data, frames_per_chunk);
+        if (frames == 0)
         {
-          std::cerr << "ALSA: write error: " << snd_strerror(static_cast<int>(written)) << std::endl;
-          snd_pcm_recover(m_pcm_handle, written, 1);
+          // Buffer underrun - wait for the producer.
+          std::this_thread::sleep_for(poll_interval);
+          continue;
         }
+        
+        snd_pcm_sframes_t written = snd_pcm_writei(m_pcm_handle, data, frames);
+        
+        if (written < 0)
+          recover(static_cast<int>(written));
+        else
+          m_ring_buffer.consume(static_cast<size_t>(written));
+        update_device_delay();
       }
     }
     
@@ -242,12 +343,15 @@ namespace applaudio
     int m_sample_rate = 0;
     int m_channels = 0;
     int m_bits = 32;
+    snd_pcm_uframes_t m_period_size = 0;
+    
+    RenderCallback m_render_callback;
+    StartupOptions m_options;
+    bool m_use_mmap = false;
+    std::atomic<int> m_device_delay { 0 };
     
-    std::vector<APL_SAMPLE_TYPE> m_ring_buffer;
-    size_t m_read_pos = 0;
-    size_t m_write_pos = 0;
-    std::mutex m_buffer_mutex;
-    std::condition_variable m_buffer_cv;
+    // Push mode only.
+    RingBuffer<APL_SAMPLE_TYPE> m_ring_buffer;
     
     std::atomic<bool> m_running{false};
     std::thread m_render_thread;
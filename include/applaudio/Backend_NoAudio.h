@@ -7,20 +7,76 @@
 
 #pragma once
 #include "IBackend.h"
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <algorithm>
 
 namespace applaudio
 {
 
   class Backend_NoAudio : public IBackend
   {
-    virtual bool startup(int /*sample_rate*/, int /*channels*/, bool /*request_exclusive_mode_if_supported*/, bool /*verbose*/) override { return true; }
-    virtual void shutdown() override {}
+  public:
+    virtual ~Backend_NoAudio() override { shutdown(); }
+
+    virtual bool startup(int /*sample_rate*/, int channels, bool /*request_exclusive_mode_if_supported*/, bool /*verbose*/) override
+    {
+      // Any channel count works without a device, so the engine's multichannel paths get exercised too.
+      m_channels = std::clamp(channels, 1, APL_MAX_CHANNELS);
+      if (m_render_callback)
+      {
+        m_running = true;
+        m_render_thread = std::thread(&Backend_NoAudio::pull_loop, this);
+      }
+      return true;
+    }
+    virtual void shutdown() override
+    {
+      m_running = false;
+      if (m_render_thread.joinable())
+        m_render_thread.join();
+    }
     virtual bool write_samples(const APL_SAMPLE_TYPE* /*data*/, size_t /*frames*/) override { return true; }
-    virtual int get_sample_rate() const override { return 44100; }
-    virtual int get_num_channels() const override { return 1; }
+    virtual int get_sample_rate() const override { return c_sample_rate; }
+    virtual int get_num_channels() const override { return m_channels; }
     virtual int get_bit_format() const override { return 32; }
     virtual int get_buffer_size_frames() const override { return 0; }
     virtual std::string backend_name() const override { return "NoAudio"; }
+    virtual int get_latency_frames() const override { return 0; }
+
+    virtual bool set_render_callback(RenderCallback callback) override
+    {
+      m_render_callback = std::move(callback);
+      return true;
+    }
+
+  private:
+    static constexpr int c_sample_rate = 44100;
+    static constexpr size_t c_period_frames = 512;
+
+    // Virtual device clock. Deadlines are derived from the total number of rendered frames
+    //   rather than accumulated per period, so the consumption rate doesn't drift.
+    void pull_loop()
+    {
+      std::vector<APL_SAMPLE_TYPE> period_buffer(c_period_frames * get_num_channels());
+      auto t0 = std::chrono::steady_clock::now();
+      long long frames_rendered = 0;
+
+      while (m_running)
+      {
+        m_render_callback(period_buffer.data(), c_period_frames);
+        frames_rendered += c_period_frames;
+
+        std::this_thread::sleep_until(t0 + std::chrono::microseconds(frames_rendered * 1'000'000 / c_sample_rate));
+      }
+    }
+
+    int m_channels = 1;
+    RenderCallback m_render_callback;
+    std::atomic<bool> m_running { false };
+    std::thread m_render_thread;
   };
 
 }
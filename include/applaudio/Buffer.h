@@ -17,6 +17,12 @@ namespace applaudio
     std::vector<APL_SAMPLE_TYPE> data;
     int channels = 0;
     int sample_rate = 0;
+    
+    // Copy of data converted to resampled_rate (the output rate), for voices at unity pitch.
+    //   Empty unless the engine's resample cache is enabled and had room for it.
+    //   Silence is assumed beyond its ends, so looping voices play it everywhere but near the loop point.
+    std::vector<APL_SAMPLE_TYPE> resampled;
+    int resampled_rate = 0;
   };
   
 }
@@ -0,0 +1,97 @@
+//
+//  Command.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "Buffer.h"
+#include "Source.h"
+#include "LinAlg.h"
+#include <array>
+#include <cstdint>
+
+namespace applaudio
+{
+
+  enum class CommandType : uint8_t
+  {
+    None,
+    // Lifetime.
+    CreateSource,
+    DestroySource,
+    SetBufferData, // Also used for buffer creation.
+    DestroyBuffer,
+    // Transport.
+    AttachBuffer,
+    DetachBuffer,
+    PlaySource,
+    PauseSource,
+    StopSource,
+    // Parameters (coalescable).
+    SetSourceGain,
+    SetSourceVolumeGain,
+    SetSourcePitch,
+    SetSourceLooping,
+    SetSourcePanning,
+    SetSourceResamplerQuality,
+    SetSourcePriority,
+    // Positional audio.
+    Init3DScene,
+    EnableSource3D,
+    SetSource3DStateChannel,
+    SetListener3DStateChannel,
+    SetSourceSpeedOfSound,
+    SetSourceAttenuation,
+    SetSourceDirectivityAlpha,
+    SetSourceDirectivitySharpness,
+    SetSourceDirectivityType,
+    SetSourceRearAttenuation,
+    SetListenerRearAttenuation,
+    SetSourceCoordSys,
+    SetListenerCoordSys,
+    SetSourceAudibleRadius,
+    SetSourceClusterable,
+    Set3DUpdateInterval,
+    Set3DUpdateBudget,
+    Set3DLodThresholds,
+    Set3DClusterAngle,
+    // Output.
+    SetOutputStage,
+    SetResamplerQuality,
+    SetMaxRealVoices,
+  };
+  
+  inline constexpr bool is_coalescable(CommandType type)
+  {
+    return type >= CommandType::SetSourceGain && type != CommandType::Init3DScene;
+  }
+
+  // Sent from the API to the mix thread. Plain data only so that it can
+  //   live in the preallocated cells of the CommandQueue.
+  struct Command
+  {
+    CommandType type = CommandType::None;
+    unsigned int id = 0;  // Source or buffer id.
+    unsigned int arg = 0; // Buffer id, channel or play id depending on type.
+    int option = 0; // Enum value for the type/convention setters.
+    int num_channels = 0;
+    bool flag = false;
+    std::array<float, 6> values {};
+    la::Mtx3 rot_mtx {};
+    la::Vec3 pos_world {};
+    la::Vec3 vel_world {};
+    const Buffer* buffer = nullptr;
+    SourceStatus* status = nullptr; // CreateSource.
+  };
+  
+  // Commands with the same key overwrite each other while still pending.
+  inline uint64_t coalesce_key(const Command& cmd)
+  {
+    return (static_cast<uint64_t>(cmd.type) << 56)
+         | (static_cast<uint64_t>(cmd.arg & 0xFFFFFF) << 32)
+         | cmd.id;
+  }
+
+}
@@ -0,0 +1,119 @@
+//
+//  CommandQueue.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <cstdint>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  // Bounded lock-free multi-producer / single-consumer queue.
+  // Each cell carries a sequence number (Vyukov style) so that producers never
+  //   need a lock and the consumer never waits for a producer.
+  // A pushed item can be rewritten in place via try_update() for as long as
+  //   the consumer hasn't claimed it. This is what allows repeated writes to
+  //   the same parameter to be coalesced into a single command.
+  template<typename T>
+  class CommandQueue
+  {
+    static constexpr uint64_t c_claimed_bit = uint64_t { 1 } << 63;
+
+    struct Cell
+    {
+      std::atomic<uint64_t> seq { 0 };
+      T data {};
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    uint64_t m_mask = 0;
+
+    alignas(64) std::atomic<uint64_t> m_enqueue_pos { 0 };
+    alignas(64) std::atomic<uint64_t> m_dequeue_pos { 0 };
+
+  public:
+    // capacity is rounded up to the nearest power of two.
+    explicit CommandQueue(size_t capacity)
+    {
+      size_t cap = 2;
+      while (cap < capacity)
+        cap <<= 1;
+      m_cells = std::make_unique<Cell[]>(cap);
+      m_mask = cap - 1;
+      for (size_t i = 0; i < cap; ++i)
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    CommandQueue(const CommandQueue&) = delete;
+    CommandQueue& operator=(const CommandQueue&) = delete;
+
+    size_t capacity() const { return static_cast<size_t>(m_mask + 1); }
+
+    // Any thread. Returns the ticket of the pushed item or nullopt if the queue is full.
+    std::optional<uint64_t> try_push(const T& item)
+    {
+      uint64_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        Cell& cell = m_cells[pos & m_mask];
+        uint64_t seq = cell.seq.load(std::memory_order_acquire);
+        auto diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+        if (diff == 0)
+        {
+          if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            cell.data = item;
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return pos;
+          }
+        }
+        else if (diff < 0)
+          return std::nullopt; // Full (or the oldest cell is claimed).
+        else
+          pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+
+    // Any thread. Rewrites a pushed item if the consumer hasn't claimed it yet.
+    //   Returns false if the item is already consumed (or being consumed).
+    template<typename Func>
+    bool try_update(uint64_t ticket, Func&& update)
+    {
+      Cell& cell = m_cells[ticket & m_mask];
+      uint64_t expected = ticket + 1;
+      if (!cell.seq.compare_exchange_strong(expected, expected | c_claimed_bit,
+                                            std::memory_order_acquire, std::memory_order_relaxed))
+        return false;
+      update(cell.data);
+      cell.seq.store(ticket + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Consumer thread only. Never blocks.
+    //   Returns false if empty or if the next item is being updated by a producer.
+    bool try_pop(T& item)
+    {
+      uint64_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      Cell& cell = m_cells[pos & m_mask];
+      uint64_t expected = pos + 1;
+      if (!cell.seq.compare_exchange_strong(expected, expected | c_claimed_bit,
+                                            std::memory_order_acquire, std::memory_order_relaxed))
+        return false;
+      item = cell.data;
+      cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+      m_dequeue_pos.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    uint64_t num_pushed() const { return m_enqueue_pos.load(std::memory_order_acquire); }
+    uint64_t num_popped() const { return m_dequeue_pos.load(std::memory_order_acquire); }
+  };
+
+}
@@ -7,11 +7,17 @@
 
 #pragma once
 #include "defines.h"
+#include "StartupOptions.h"
 #include <string>
+#include <functional>
 
 namespace applaudio
 {
   
+  // Called by the backend whenever the device needs more data.
+  //   Must fill data with exactly frames interleaved frames.
+  using RenderCallback = std::function<void(APL_SAMPLE_TYPE* data, size_t frames)>;
+  
   struct IBackend
   {
     virtual ~IBackend() {}
@@ -23,6 +29,21 @@ namespace applaudio
     virtual int get_bit_format() const = 0;
     virtual int get_buffer_size_frames() const = 0;
     virtual std::string backend_name() const = 0;
+    
+    // Preferred number of frames per mix.
+    virtual int get_period_size_frames() const { return get_buffer_size_frames(); }
+    
+    // Frames written but not yet played (device + software buffering). -1 if unknown.
+    virtual int get_latency_frames() const { return -1; }
+    
+    // Pull mode. Call before startup(). If supported (returns true), the backend
+    //   paces rendering from its own device thread by invoking callback and
+    //   write_samples() is no longer used.
+    //   Backends that don't support it keep the push model (write_samples()).
+    virtual bool set_render_callback(RenderCallback /*callback*/) { return false; }
+    
+    // Call before startup().
+    virtual void set_startup_options(const StartupOptions& /*options*/) {}
   };
   
 }
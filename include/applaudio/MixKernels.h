@@ -0,0 +1,414 @@
+//
+//  MixKernels.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "defines.h"
+#include "Simd.h"
+#include "Resampler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace applaudio
+{
+
+  // A voice is mixed in two stages:
+  //   1. An interpolator from Resampler.h resamples the source channels into planar float scratch rows.
+  //   2. mix_gain_matrix() multiplies the rows with a dst_ch x src_ch gain matrix and accumulates
+  //      into an interleaved float bus. Flat mixing (gain/pan/up/down-mix) and 3D mixing only
+  //      differ in the gain matrix, which is computed once per voice per block.
+  //
+  // Kernels are templated on the source and output channel counts (c_dyn = given at runtime)
+  //   and on looping. select_voice_kernel() picks the instantiation once per voice per block,
+  //   which leaves the inner loops with fixed trip counts and no per-frame branches.
+  namespace mix_kernels
+  {
+
+    // ----- Stage 2 -----
+
+    inline void mix_gain_matrix_scalar(const float* scratch, size_t stride, int src_ch, int dst_ch,
+                                       const float* gains, int f_begin, int f_end, float* out)
+    {
+      for (int f = f_begin; f < f_end; ++f)
+        for (int l = 0; l < dst_ch; ++l)
+        {
+          float sum = 0.f;
+          for (int s = 0; s < src_ch; ++s)
+            sum += gains[l * src_ch + s] * scratch[s * stride + f];
+          out[f * dst_ch + l] += sum;
+        }
+    }
+
+    // Stage 2. out[f * dst_ch + l] += sum_s gains[l * src_ch + s] * row_s[f].
+    //   out is a float bus with headroom. Nothing is clamped until the output stage.
+    template<int SrcCh, int DstCh>
+    inline void mix_gain_matrix(const float* scratch, size_t stride, int src_ch_rt, int dst_ch_rt,
+                                const float* gains, int num_frames, float* out)
+    {
+      const int src_ch = SrcCh != c_dyn ? SrcCh : src_ch_rt;
+      const int dst_ch = DstCh != c_dyn ? DstCh : dst_ch_rt;
+      int f = 0;
+      if constexpr (DstCh == 1 || DstCh == 2)
+      {
+        constexpr int W = simd::c_width;
+
+        // Hoisted gains when the source channel count is known.
+        constexpr int NumG = SrcCh != c_dyn ? DstCh * SrcCh : 1;
+        simd::vfloat g[NumG];
+        if constexpr (SrcCh != c_dyn)
+          for (int i = 0; i < NumG; ++i)
+            g[i] = simd::set1(gains[i]);
+
+        for (; f + W <= num_frames; f += W)
+        {
+          simd::vfloat acc[DstCh];
+          for (int l = 0; l < DstCh; ++l)
+          {
+            acc[l] = simd::set1(0.f);
+            for (int s = 0; s < src_ch; ++s)
+            {
+              const auto g_ls = SrcCh != c_dyn ? g[l * src_ch + s] : simd::set1(gains[l * src_ch + s]);
+              acc[l] = simd::add(acc[l], simd::mul(g_ls, simd::load(scratch + s * stride + f)));
+            }
+          }
+
+          if constexpr (DstCh == 1)
+            simd::store(out + f, simd::add(simd::load(out + f), acc[0]));
+          else
+          {
+            simd::vfloat lr_lo, lr_hi;
+            simd::interleave(acc[0], acc[1], lr_lo, lr_hi);
+            float* dst = out + 2 * f;
+            simd::store(dst, simd::add(simd::load(dst), lr_lo));
+            simd::store(dst + W, simd::add(simd::load(dst + W), lr_hi));
+          }
+        }
+      }
+      mix_gain_matrix_scalar(scratch, stride, src_ch, dst_ch, gains, f, num_frames, out);
+    }
+    
+    // Stage 2 with gains that ramp linearly from gains_begin to gains over a block of block_frames
+    //   frames, i.e. frame f gets gains_begin + (gains - gains_begin) * (f + 1) / block_frames.
+    //   Only the first num_frames frames are mixed (fewer if a voice ends).
+    template<int SrcCh, int DstCh>
+    inline void mix_gain_matrix_ramp(const float* scratch, size_t stride, int src_ch_rt, int dst_ch_rt,
+                                     const float* gains_begin, const float* gains, int num_frames, int block_frames,
+                                     float* out)
+    {
+      const int src_ch = SrcCh != c_dyn ? SrcCh : src_ch_rt;
+      const int dst_ch = DstCh != c_dyn ? DstCh : dst_ch_rt;
+      const float scale = 1.f / block_frames;
+      int f = 0;
+      if constexpr (DstCh == 1 || DstCh == 2)
+      {
+        constexpr int W = simd::c_width;
+        const simd::vfloat v_scale = simd::set1(scale);
+        for (; f + W <= num_frames; f += W)
+        {
+          const simd::vfloat t = simd::mul(simd::add(simd::ramp(), simd::set1(static_cast<float>(f + 1))), v_scale);
+          simd::vfloat acc[DstCh];
+          for (int l = 0; l < DstCh; ++l)
+          {
+            acc[l] = simd::set1(0.f);
+            for (int s = 0; s < src_ch; ++s)
+            {
+              const float g0 = gains_begin[l * src_ch + s];
+              const auto g_ls = simd::add(simd::set1(g0), simd::mul(simd::set1(gains[l * src_ch + s] - g0), t));
+              acc[l] = simd::add(acc[l], simd::mul(g_ls, simd::load(scratch + s * stride + f)));
+            }
+          }
+          
+          if constexpr (DstCh == 1)
+            simd::store(out + f, simd::add(simd::load(out + f), acc[0]));
+          else
+          {
+            simd::vfloat lr_lo, lr_hi;
+            simd::interleave(acc[0], acc[1], lr_lo, lr_hi);
+            float* dst = out + 2 * f;
+            simd::store(dst, simd::add(simd::load(dst), lr_lo));
+            simd::store(dst + W, simd::add(simd::load(dst + W), lr_hi));
+          }
+        }
+      }
+      for (; f < num_frames; ++f)
+      {
+        const float t = (f + 1) * scale;
+        for (int l = 0; l < dst_ch; ++l)
+        {
+          float sum = 0.f;
+          for (int s = 0; s < src_ch; ++s)
+          {
+            const float g0 = gains_begin[l * src_ch + s];
+            sum += (g0 + (gains[l * src_ch + s] - g0) * t) * scratch[s * stride + f];
+          }
+          out[f * dst_ch + l] += sum;
+        }
+      }
+    }
+
+    // ----- Voice kernels -----
+    
+    constexpr int c_step_ramp_segments = 8;
+
+    // Everything a voice kernel needs for one block. phase and playing are updated.
+    struct VoiceBlock
+    {
+      const APL_SAMPLE_TYPE* data = nullptr;
+      size_t buf_frames = 0;
+      int src_ch = 0;
+      int dst_ch = 0;
+      uint64_t phase = 0;
+      uint64_t step = 0;
+      // If set, the step goes from step_begin to step over the block, in c_step_ramp_segments
+      //   segments of constant step each.
+      bool ramp_step = false;
+      uint64_t step_begin = 0;
+      bool playing = true;
+      ResamplerQuality quality = ResamplerQuality::Linear;
+      int fade = 0; // 1: fade in over the block, -1: fade out over the block.
+      const float* gains = nullptr; // dst_ch x src_ch, row major.
+      const float* gains_begin = nullptr; // If set, the gains ramp from these to gains over the block.
+      // If set, the source channels are summed into one before stage 2, and gains (and gains_begin)
+      //   are dst_ch x 1.
+      bool collapse_to_mono = false;
+      float* scratch = nullptr; // src_ch rows of stride floats.
+      size_t stride = 0;
+      int num_frames = 0;
+      float* out = nullptr; // Interleaved float bus.
+    };
+
+    // Stage 1 for a whole block: handles wrapping and the end of the buffer around the interpolator.
+    //   Wraps, ends and buffer edges are found per segment rather than tested per frame.
+    //   A wrap keeps the fractional phase, so loops stay phase accurate.
+    //   Frames whose taps reach outside the buffer fetch them one by one: a looping voice
+    //   reads across the loop point and a one-shot voice reads silence.
+    //   Returns the number of frames produced (fewer if a non-looping voice ends).
+    template<int SrcCh, bool Looping, typename Interp>
+    inline int resample_voice(const Interp& interp, VoiceBlock& v)
+    {
+      constexpr int c_taps = Interp::c_taps;
+      constexpr int c_left = Interp::c_left;
+      constexpr int c_right = c_taps - 1 - c_left;
+      const int ch = SrcCh != c_dyn ? SrcCh : v.src_ch;
+      const size_t buf_frames = v.buf_frames;
+      if (buf_frames == 0)
+      {
+        if constexpr (!Looping)
+          v.playing = false;
+        return 0;
+      }
+
+      const uint64_t end_phase = static_cast<uint64_t>(buf_frames) << c_phase_frac_bits;
+      // Frames with a phase in [fast_begin, fast_end) have all their taps inside the buffer.
+      const uint64_t fast_begin = static_cast<uint64_t>(c_left) << c_phase_frac_bits;
+      const uint64_t fast_end = buf_frames > static_cast<size_t>(c_right) ? static_cast<uint64_t>(buf_frames - c_right) << c_phase_frac_bits : 0;
+
+      uint64_t phase = v.phase;
+      uint64_t step = v.step;
+      const int num_segments = v.ramp_step ? c_step_ramp_segments : 1;
+      int seg = 0;
+      int seg_end = 0; // Frame where the current step segment ends.
+      int f = 0;
+      while (f < v.num_frames)
+      {
+        while (f == seg_end)
+        {
+          // The last segment ends on v.step.
+          ++seg;
+          seg_end = v.num_frames * seg / num_segments;
+          if (v.ramp_step)
+            step = static_cast<uint64_t>(static_cast<int64_t>(v.step_begin)
+              + (static_cast<int64_t>(v.step) - static_cast<int64_t>(v.step_begin)) * seg / num_segments);
+        }
+        
+        if (phase >= end_phase)
+        {
+          if constexpr (Looping)
+            phase %= end_phase; // wrap
+          else
+          {
+            v.playing = false;
+            break;
+          }
+        }
+
+        if (phase >= fast_begin && phase < fast_end)
+        {
+          int n = seg_end - f;
+          if (step > 0)
+            n = static_cast<int>(std::min<uint64_t>(n, (fast_end - phase + step - 1) / step));
+          interp.template run<SrcCh>(v.data, ch, phase, step, n, v.scratch + f, v.stride);
+          phase += n * step;
+          f += n;
+          continue;
+        }
+
+        // Near an edge of the buffer.
+        alignas(64) float w[c_taps];
+        interp.weights(phase, w);
+        const auto first = static_cast<int64_t>(phase_index(phase)) - c_left;
+        for (int c = 0; c < ch; ++c)
+        {
+          float sum = 0.f;
+          for (int k = 0; k < c_taps; ++k)
+          {
+            auto i = first + k;
+            if constexpr (Looping)
+              i = (i % static_cast<int64_t>(buf_frames) + static_cast<int64_t>(buf_frames)) % static_cast<int64_t>(buf_frames);
+            else if (i < 0 || i >= static_cast<int64_t>(buf_frames))
+              continue;
+            sum += w[k] * static_cast<float>(v.data[static_cast<size_t>(i) * ch + c]);
+          }
+          v.scratch[c * v.stride + f] = sum;
+        }
+        phase += step;
+        ++f;
+      }
+
+      v.phase = phase;
+      return f;
+    }
+
+    // The quality is a runtime switch per voice per block. Every branch runs a whole block.
+    //   Voices at unity step and an integer phase (e.g. buffers at the output rate) are plain copies.
+    template<int SrcCh, bool Looping>
+    inline int resample_voice(VoiceBlock& v)
+    {
+      if (v.step == c_phase_one && static_cast<uint32_t>(v.phase) == 0)
+        return resample_voice<SrcCh, Looping>(InterpCopy {}, v);
+      switch (v.quality)
+      {
+        case ResamplerQuality::Cubic:
+          return resample_voice<SrcCh, Looping>(InterpCubic {}, v);
+        case ResamplerQuality::Sinc8:
+          return resample_voice<SrcCh, Looping>(InterpSinc<8> { sinc_tables().get(8, v.step) }, v);
+        case ResamplerQuality::Sinc16:
+          return resample_voice<SrcCh, Looping>(InterpSinc<16> { sinc_tables().get(16, v.step) }, v);
+        case ResamplerQuality::Sinc32:
+          return resample_voice<SrcCh, Looping>(InterpSinc<32> { sinc_tables().get(32, v.step) }, v);
+        case ResamplerQuality::Linear:
+        default:
+          return resample_voice<SrcCh, Looping>(InterpLinear {}, v);
+      }
+    }
+
+    // Offline conversion of a whole buffer from src_rate to dst_rate with the 32 tap sinc.
+    //   The output has ceil(src_frames * dst_rate / src_rate) frames. Outside the buffer is silence.
+    inline void resample_buffer(const std::vector<APL_SAMPLE_TYPE>& data, int channels, int src_rate, int dst_rate,
+                                std::vector<APL_SAMPLE_TYPE>& out)
+    {
+      constexpr int c_block = 1024;
+      const size_t src_frames = data.size() / channels;
+      const size_t dst_frames = (src_frames * dst_rate + src_rate - 1) / src_rate;
+      out.assign(dst_frames * channels, APL_SAMPLE_TYPE {});
+      std::vector<float> scratch(static_cast<size_t>(c_block) * channels);
+
+      VoiceBlock v;
+      v.data = data.data();
+      v.buf_frames = src_frames;
+      v.src_ch = channels;
+      v.step = rescale_phase(c_phase_one, src_rate, dst_rate);
+      v.scratch = scratch.data();
+      v.stride = c_block;
+      const InterpSinc<32> interp { sinc_tables().get(32, v.step) };
+      for (size_t f0 = 0; f0 < dst_frames; f0 += c_block)
+      {
+        // Exact start phase for every block, so that the rounded step doesn't drift.
+        v.phase = rescale_phase(static_cast<uint64_t>(f0) << c_phase_frac_bits, src_rate, dst_rate);
+        v.num_frames = static_cast<int>(std::min<size_t>(c_block, dst_frames - f0));
+        const int n = resample_voice<c_dyn, false>(interp, v);
+        for (int f = 0; f < n; ++f)
+          for (int c = 0; c < channels; ++c)
+          {
+            const float x = scratch[c * c_block + f];
+#ifdef APL_32
+            out[(f0 + f) * channels + c] = x;
+#else
+            out[(f0 + f) * channels + c] = static_cast<short>(std::lround(std::clamp(x, APL_SHORT_MIN_F, APL_SHORT_MAX_F)));
+#endif
+          }
+      }
+    }
+
+    // Linear ramp over a whole block of block_frames frames, applied to the first num_frames.
+    inline void apply_fade(float* scratch, size_t stride, int src_ch, int num_frames, int block_frames, bool fade_in)
+    {
+      const float scale = 1.f / block_frames;
+      for (int c = 0; c < src_ch; ++c)
+      {
+        float* row = scratch + c * stride;
+        for (int f = 0; f < num_frames; ++f)
+          row[f] *= fade_in ? (f + 1) * scale : (block_frames - 1 - f) * scale;
+      }
+    }
+
+    // Adds rows 1 to src_ch - 1 of scratch onto row 0.
+    inline void sum_rows(float* scratch, size_t stride, int src_ch, int num_frames)
+    {
+      for (int c = 1; c < src_ch; ++c)
+      {
+        const float* row = scratch + c * stride;
+        for (int f = 0; f < num_frames; ++f)
+          scratch[f] += row[f];
+      }
+    }
+
+    template<int SrcCh, int DstCh, bool Looping>
+    inline void mix_voice(VoiceBlock& v)
+    {
+      int frames = resample_voice<SrcCh, Looping>(v);
+      if (v.collapse_to_mono && frames > 0)
+      {
+        sum_rows(v.scratch, v.stride, v.src_ch, frames);
+        if (v.fade != 0)
+          apply_fade(v.scratch, v.stride, 1, frames, v.num_frames, v.fade > 0);
+        if (v.gains_begin != nullptr)
+          mix_gain_matrix_ramp<1, DstCh>(v.scratch, v.stride, 1, v.dst_ch, v.gains_begin, v.gains, frames, v.num_frames, v.out);
+        else
+          mix_gain_matrix<1, DstCh>(v.scratch, v.stride, 1, v.dst_ch, v.gains, frames, v.out);
+        return;
+      }
+      if (v.fade != 0)
+        apply_fade(v.scratch, v.stride, SrcCh != c_dyn ? SrcCh : v.src_ch, frames, v.num_frames, v.fade > 0);
+      if (frames > 0 && v.gains_begin != nullptr)
+        mix_gain_matrix_ramp<SrcCh, DstCh>(v.scratch, v.stride, v.src_ch, v.dst_ch, v.gains_begin, v.gains, frames, v.num_frames, v.out);
+      else if (frames > 0)
+        mix_gain_matrix<SrcCh, DstCh>(v.scratch, v.stride, v.src_ch, v.dst_ch, v.gains, frames, v.out);
+    }
+
+    using VoiceKernel = void (*)(VoiceBlock&);
+
+    inline VoiceKernel select_voice_kernel(int src_ch, int dst_ch, bool looping)
+    {
+      // [src: dyn, mono, stereo][dst: dyn, mono, stereo][looping]
+      static constexpr VoiceKernel c_table[3][3][2] =
+      {
+        {
+          { &mix_voice<c_dyn, c_dyn, false>, &mix_voice<c_dyn, c_dyn, true> },
+          { &mix_voice<c_dyn, 1, false>, &mix_voice<c_dyn, 1, true> },
+          { &mix_voice<c_dyn, 2, false>, &mix_voice<c_dyn, 2, true> },
+        },
+        {
+          { &mix_voice<1, c_dyn, false>, &mix_voice<1, c_dyn, true> },
+          { &mix_voice<1, 1, false>, &mix_voice<1, 1, true> },
+          { &mix_voice<1, 2, false>, &mix_voice<1, 2, true> },
+        },
+        {
+          { &mix_voice<2, c_dyn, false>, &mix_voice<2, c_dyn, true> },
+          { &mix_voice<2, 1, false>, &mix_voice<2, 1, true> },
+          { &mix_voice<2, 2, false>, &mix_voice<2, 2, true> },
+        },
+      };
+      auto idx = [](int ch) { return ch == 1 || ch == 2 ? ch : 0; };
+      return c_table[idx(src_ch)][idx(dst_ch)][looping ? 1 : 0];
+    }
+
+  }
+
+}
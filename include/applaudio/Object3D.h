@@ -6,8 +6,10 @@
 //
 
 #pragma once
+#include "defines.h"
 #include "LinAlg.h"
-#include <vector>
+#include <array>
+#include <algorithm>
 
 namespace applaudio
 {
@@ -15,18 +17,12 @@ namespace applaudio
   namespace a3d
   {
     
-    struct Param3D
-    {
-      float gain = 1.f;
-      float doppler_shift = 1.f;
-    };
-    
+    // The parameters derived from these are kept in a ParamTable.
     struct State3D
     {
       la::Mtx3 rot_mtx;
       la::Vec3 pos_world;
       la::Vec3 vel_world;
-      std::vector<Param3D> listener_ch_params;
     };
     
     // #NOTE: We're not changing handedness here.
@@ -41,20 +37,21 @@ namespace applaudio
     
     class Object3D
     {
-      std::vector<State3D> channel_state;
+      std::array<State3D, APL_MAX_CHANNELS> channel_state {};
+      int n_channels = 0;
       bool audio_3d_enabled = false;
       CoordSysConvention cs_convention = CoordSysConvention::RH_XLeft_YUp_ZForward; // +Z is forward by default.
       
-      template <typename VecT>
-      static auto get_state_impl(VecT& channel_state, int ch) -> decltype(&channel_state[0])
+      template <typename ArrayT>
+      static auto get_state_impl(ArrayT& channel_state, int n_channels, int ch) -> decltype(&channel_state[0])
       {
-        if (channel_state.empty())
+        if (n_channels == 0)
           return nullptr;
         
-        if (channel_state.size() == 1)
+        if (n_channels == 1)
           return &channel_state[0];
         
-        if (ch < static_cast<int>(channel_state.size()))
+        if (ch < n_channels)
           return &channel_state[ch];
         
         return &channel_state.front();
@@ -102,19 +99,26 @@ namespace applaudio
       
       State3D* get_channel_state(int ch)
       {
-        return get_state_impl(channel_state, ch);
+        return get_state_impl(channel_state, n_channels, ch);
       }
       
       const State3D* get_channel_state(int ch) const
       {
-        return get_state_impl(channel_state, ch);
+        return get_state_impl(channel_state, n_channels, ch);
       }
       
       bool using_3d_audio() const { return audio_3d_enabled; }
       void enable_3d_audio(bool enable) { audio_3d_enabled = enable; }
       
-      int num_channels() const { return static_cast<int>(channel_state.size()); }
-      void set_num_channels(int num_ch) { channel_state.resize(num_ch); }
+      int num_channels() const { return n_channels; }
+      // Clamped to APL_MAX_CHANNELS. Added channels start out default initialized.
+      void set_num_channels(int num_ch)
+      {
+        num_ch = std::clamp(num_ch, 0, APL_MAX_CHANNELS);
+        for (int ch = n_channels; ch < num_ch; ++ch)
+          channel_state[ch] = {};
+        n_channels = num_ch;
+      }
       
       const la::Vec3 dir_right(int ch) const
       {
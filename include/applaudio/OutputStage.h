@@ -0,0 +1,200 @@
+//
+//  OutputStage.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "defines.h"
+#include "Simd.h"
+#include "AlignedBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  enum class OutputStageType
+  {
+    HardClip, // Clamp to full scale.
+    SoftClip, // Smooth saturation towards full scale. Also bends signals below full scale slightly.
+    Limiter,  // Lookahead peak limiter. Adds c_limiter_lookahead_s of latency.
+  };
+
+  // Final stage of the mixer. The voices are summed into a float bus with headroom,
+  //   and this turns the bus into output samples: optional soft clip or limiting,
+  //   then a single clamp and conversion to APL_SAMPLE_TYPE.
+  //   The bus is in APL_SAMPLE_TYPE units, i.e. full scale is 1 for float output and 32768 for 16 bit output.
+  class OutputStage
+  {
+  public:
+    static constexpr float c_limiter_lookahead_s = 0.0015f;
+    static constexpr float c_limiter_release_s = 0.05f;
+
+    static int limiter_lookahead_frames(int sample_rate)
+    {
+      return std::max(1, static_cast<int>(std::lround(sample_rate * c_limiter_lookahead_s)));
+    }
+
+    // Allocates the limiter state. Call before rendering starts.
+    void reset(int num_channels, int sample_rate)
+    {
+      m_channels = num_channels;
+      m_lookahead = limiter_lookahead_frames(sample_rate);
+      m_attack_coeff = 1.f - std::exp(-4.6f / m_lookahead); // Within 1% at the end of the lookahead.
+      m_release_coeff = 1.f - std::exp(-1.f / (c_limiter_release_s * sample_rate));
+      m_delay.resize(static_cast<size_t>(m_lookahead) * std::max(num_channels, 1));
+      m_delay_target.resize(m_lookahead);
+      // The window spans m_lookahead + 1 frames, and a frame is pushed before the expired head is popped.
+      m_window_gain.resize(m_lookahead + 2);
+      m_window_frame.resize(m_lookahead + 2);
+      clear_limiter();
+    }
+
+    void set_type(OutputStageType type)
+    {
+      if (type == OutputStageType::Limiter && m_type != OutputStageType::Limiter)
+        clear_limiter();
+      m_type = type;
+    }
+    OutputStageType get_type() const { return m_type; }
+
+    // Consumes num_frames interleaved frames of bus (which is used as scratch) and writes them to out.
+    void process(float* bus, int num_frames, APL_SAMPLE_TYPE* out)
+    {
+      const size_t num_samples = static_cast<size_t>(num_frames) * m_channels;
+      switch (m_type)
+      {
+        case OutputStageType::HardClip:
+          break;
+        case OutputStageType::SoftClip:
+          soft_clip(bus, num_samples);
+          break;
+        case OutputStageType::Limiter:
+          if (m_lookahead > 0) // Else reset() was never called. Degrade to hard clip.
+            limit(bus, num_frames);
+          break;
+      }
+      convert(bus, num_samples, out);
+    }
+
+  private:
+    static constexpr float c_full_scale = APL_SHORT_LIMIT_F / APL_SAMPLE_SCALE;
+
+    // Pade approximant of tanh, x * (27 + x^2) / (27 + 9 x^2), which reaches exactly 1 at x = 3.
+    static void soft_clip(float* bus, size_t num_samples)
+    {
+      constexpr int W = simd::c_width;
+      const auto v_scale = simd::set1(1.f / c_full_scale);
+      const auto v_full = simd::set1(c_full_scale);
+      const auto v_lo = simd::set1(-3.f);
+      const auto v_hi = simd::set1(3.f);
+      const auto v_27 = simd::set1(27.f);
+      const auto v_9 = simd::set1(9.f);
+      size_t i = 0;
+      for (; i + W <= num_samples; i += W)
+      {
+        auto x = simd::clamp(simd::mul(simd::load(bus + i), v_scale), v_lo, v_hi);
+        auto x2 = simd::mul(x, x);
+        auto y = simd::div(simd::mul(x, simd::add(v_27, x2)), simd::add(v_27, simd::mul(v_9, x2)));
+        simd::store(bus + i, simd::mul(y, v_full));
+      }
+      for (; i < num_samples; ++i)
+      {
+        float x = std::clamp(bus[i] / c_full_scale, -3.f, 3.f);
+        float x2 = x * x;
+        bus[i] = c_full_scale * x * (27.f + x2) / (27.f + 9.f * x2);
+      }
+    }
+
+    void clear_limiter()
+    {
+      std::fill(m_delay.data(), m_delay.data() + m_delay.size(), 0.f);
+      std::fill(m_delay_target.data(), m_delay_target.data() + m_delay_target.size(), 1.f);
+      m_delay_pos = 0;
+      m_window_head = 0;
+      m_window_tail = 0;
+      m_frame = 0;
+      m_gain = 1.f;
+    }
+
+    // Each output frame is delayed by the lookahead and scaled by a gain that follows
+    //   the minimum required gain over the frames up to lookahead ahead of it.
+    //   The sliding minimum is a monotonic queue in preallocated rings. The attack only gets
+    //   within 1% of that minimum over the lookahead, so the gain is also capped by the
+    //   required gain of the output frame itself, which keeps peaks out of the final clamp.
+    void limit(float* bus, int num_frames)
+    {
+      const int ch = m_channels;
+      const size_t window_size = m_window_gain.size();
+      for (int f = 0; f < num_frames; ++f, ++m_frame)
+      {
+        float* frame = bus + static_cast<size_t>(f) * ch;
+        float* delayed = m_delay.data() + static_cast<size_t>(m_delay_pos) * ch;
+
+        float peak = 0.f;
+        for (int c = 0; c < ch; ++c)
+          peak = std::max(peak, std::abs(frame[c]));
+        const float target = peak > c_full_scale ? c_full_scale / peak : 1.f;
+
+        while (m_window_tail != m_window_head && m_window_gain[(m_window_tail - 1) % window_size] >= target)
+          --m_window_tail;
+        m_window_gain[m_window_tail % window_size] = target;
+        m_window_frame[m_window_tail % window_size] = m_frame;
+        ++m_window_tail;
+        while (m_window_frame[m_window_head % window_size] + m_lookahead < m_frame)
+          ++m_window_head;
+
+        const float window_min = m_window_gain[m_window_head % window_size];
+        m_gain += (window_min - m_gain) * (window_min < m_gain ? m_attack_coeff : m_release_coeff);
+
+        const float gain = std::min(m_gain, m_delay_target[m_delay_pos]);
+        m_delay_target[m_delay_pos] = target;
+        for (int c = 0; c < ch; ++c)
+        {
+          const float x = frame[c];
+          frame[c] = delayed[c] * gain;
+          delayed[c] = x;
+        }
+        if (++m_delay_pos == m_lookahead)
+          m_delay_pos = 0;
+      }
+    }
+
+    static void convert(const float* bus, size_t num_samples, APL_SAMPLE_TYPE* out)
+    {
+#ifdef APL_32
+      constexpr int W = simd::c_width;
+      const auto lo = simd::set1(APL_SAMPLE_MIN);
+      const auto hi = simd::set1(APL_SAMPLE_MAX);
+      size_t i = 0;
+      for (; i + W <= num_samples; i += W)
+        simd::store(out + i, simd::clamp(simd::load(bus + i), lo, hi));
+      for (; i < num_samples; ++i)
+        out[i] = std::clamp(bus[i], APL_SAMPLE_MIN, APL_SAMPLE_MAX);
+#else
+      for (size_t i = 0; i < num_samples; ++i)
+        out[i] = static_cast<short>(std::clamp(bus[i], APL_SHORT_MIN_F, APL_SHORT_MAX_F));
+#endif
+    }
+
+    OutputStageType m_type = OutputStageType::HardClip;
+    int m_channels = 0;
+
+    int m_lookahead = 0;
+    float m_attack_coeff = 1.f;
+    float m_release_coeff = 1.f;
+    float m_gain = 1.f;
+    AlignedBuffer<float> m_delay; // m_lookahead interleaved frames.
+    AlignedBuffer<float> m_delay_target; // Required gain of each delayed frame.
+    int m_delay_pos = 0;
+    AlignedBuffer<float> m_window_gain;
+    AlignedBuffer<size_t> m_window_frame;
+    size_t m_window_head = 0;
+    size_t m_window_tail = 0;
+    size_t m_frame = 0;
+  };
+
+}
@@ -0,0 +1,155 @@
+//
+//  ParamTable.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "defines.h"
+#include "AlignedBuffer.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  namespace a3d
+  {
+  
+    // Gains and doppler shifts from each emitter channel of a 3D voice to each listener channel,
+    //   for all voices in two contiguous arrays indexed by voice slot. A voice's block holds
+    //   c_inline_emitter_channels x num_listener_channels() floats, emitter channel major, so the
+    //   scene update writes it and the mixer reads it front to back. Emitters with more channels
+    //   than that keep the rows of the remaining channels in a per-voice overflow block.
+    class ParamTable
+    {
+    public:
+      // Mono and stereo emitters fit inline.
+      static constexpr int c_inline_emitter_channels = 2;
+      
+      // Emitter channel whose parameters apply to buffer channel ch_s. -1 if there are none.
+      //   Buffer channels beyond the number of emitters share the parameters of channel 0.
+      static int emitter_of(int ch_s, int num_emitters)
+      {
+        if (num_emitters == 0)
+          return -1;
+        return ch_s < num_emitters ? ch_s : 0;
+      }
+      
+      // Preallocates num_voices slots for up to APL_MAX_CHANNELS listener channels, and room
+      //   for an overflow block per voice. reset(), set_num_emitters() and
+      //   set_num_listener_channels() below that don't allocate.
+      void reserve(size_t num_voices)
+      {
+        grow(num_voices * c_inline_emitter_channels * APL_MAX_CHANNELS);
+        m_num_emitters.reserve(num_voices);
+        m_overflow_of.reserve(num_voices);
+        m_overflow_gains.reserve(num_voices * c_overflow_size);
+        m_overflow_doppler_shifts.reserve(num_voices * c_overflow_size);
+        m_free_overflow.reserve(num_voices);
+      }
+      
+      // Changes the layout, which resets the parameters of all voices.
+      void set_num_listener_channels(int num_ch)
+      {
+        m_num_listener_ch = std::clamp(num_ch, 0, APL_MAX_CHANNELS);
+        grow(m_num_emitters.size() * stride());
+        for (uint32_t v = 0; v < m_num_emitters.size(); ++v)
+          reset(v);
+      }
+      
+      int num_listener_channels() const { return m_num_listener_ch; }
+      
+      // Slot v starts out without emitters, i.e. silent.
+      void reset(uint32_t v)
+      {
+        if (v >= m_num_emitters.size())
+        {
+          grow((v + 1) * stride());
+          m_num_emitters.resize(v + 1);
+          m_overflow_of.resize(v + 1, c_no_overflow);
+        }
+        set_num_emitters(v, 0);
+        std::fill(m_gains.data() + v * stride(), m_gains.data() + (v + 1) * stride(), 0.f);
+        std::fill(m_doppler_shifts.data() + v * stride(), m_doppler_shifts.data() + (v + 1) * stride(), 1.f);
+      }
+      
+      int num_emitters(uint32_t v) const { return m_num_emitters[v]; }
+      // Takes an overflow block for v when it gets more than c_inline_emitter_channels emitters,
+      //   and hands it back when it no longer has.
+      void set_num_emitters(uint32_t v, int num_emitters)
+      {
+        num_emitters = std::clamp(num_emitters, 0, APL_MAX_CHANNELS);
+        m_num_emitters[v] = static_cast<uint8_t>(num_emitters);
+        uint32_t& block = m_overflow_of[v];
+        if (num_emitters > c_inline_emitter_channels && block == c_no_overflow)
+        {
+          if (m_free_overflow.empty())
+          {
+            block = static_cast<uint32_t>(m_overflow_gains.size() / c_overflow_size);
+            m_overflow_gains.resize(m_overflow_gains.size() + c_overflow_size);
+            m_overflow_doppler_shifts.resize(m_overflow_doppler_shifts.size() + c_overflow_size);
+          }
+          else
+          {
+            block = m_free_overflow.back();
+            m_free_overflow.pop_back();
+          }
+          std::fill_n(m_overflow_gains.data() + block * c_overflow_size, c_overflow_size, 0.f);
+          std::fill_n(m_overflow_doppler_shifts.data() + block * c_overflow_size, c_overflow_size, 1.f);
+        }
+        else if (num_emitters <= c_inline_emitter_channels && block != c_no_overflow)
+        {
+          m_free_overflow.push_back(block);
+          block = c_no_overflow;
+        }
+      }
+      
+      // The num_listener_channels() parameters of emitter channel ch_e < num_emitters(v).
+      float* gains(uint32_t v, int ch_e) { return row(m_gains.data(), m_overflow_gains.data(), v, ch_e); }
+      const float* gains(uint32_t v, int ch_e) const { return const_cast<ParamTable*>(this)->gains(v, ch_e); }
+      float* doppler_shifts(uint32_t v, int ch_e) { return row(m_doppler_shifts.data(), m_overflow_doppler_shifts.data(), v, ch_e); }
+      const float* doppler_shifts(uint32_t v, int ch_e) const { return const_cast<ParamTable*>(this)->doppler_shifts(v, ch_e); }
+      
+    private:
+      static constexpr size_t c_overflow_size = static_cast<size_t>(std::max(APL_MAX_CHANNELS - c_inline_emitter_channels, 0)) * APL_MAX_CHANNELS;
+      static constexpr uint32_t c_no_overflow = ~0u;
+      
+      size_t stride() const { return static_cast<size_t>(c_inline_emitter_channels) * m_num_listener_ch; }
+      
+      float* row(float* inline_params, float* overflow_params, uint32_t v, int ch_e) const
+      {
+        if (ch_e < c_inline_emitter_channels)
+          return inline_params + v * stride() + static_cast<size_t>(ch_e) * m_num_listener_ch;
+        return overflow_params + m_overflow_of[v] * c_overflow_size + static_cast<size_t>(ch_e - c_inline_emitter_channels) * APL_MAX_CHANNELS;
+      }
+      
+      void grow(size_t size)
+      {
+        if (m_gains.size() >= size)
+          return;
+        size = std::max(size, 2 * m_gains.size());
+        for (auto* arr : { &m_gains, &m_doppler_shifts })
+        {
+          AlignedBuffer<float> grown(size);
+          std::copy(arr->data(), arr->data() + arr->size(), grown.data());
+          *arr = std::move(grown);
+        }
+      }
+      
+      AlignedBuffer<float> m_gains;
+      AlignedBuffer<float> m_doppler_shifts;
+      std::vector<uint8_t> m_num_emitters;
+      std::vector<uint32_t> m_overflow_of; // Overflow block of each voice, or c_no_overflow.
+      std::vector<float> m_overflow_gains;
+      std::vector<float> m_overflow_doppler_shifts;
+      std::vector<uint32_t> m_free_overflow;
+      int m_num_listener_ch = 0;
+    };
+    
+  }
+
+}
@@ -8,8 +8,10 @@
 #pragma once
 #include "Source.h"
 #include "Listener.h"
+#include "ParamTable.h"
+#include "Simd.h"
 #include <optional>
-#include <unordered_map>
+#include <vector>
 #include <algorithm>
 #include <cassert>
 
@@ -22,13 +24,89 @@ namespace applaudio
         
     class PositionalAudio
     {
+      // One lane per emitter channel, structure of arrays.
+      struct EmitterLanes
+      {
+        std::vector<float> pos_x, pos_y, pos_z;
+        std::vector<float> vel_x, vel_y, vel_z;
+        std::vector<float> fwd_x, fwd_y, fwd_z;
+        std::vector<float> speed_of_sound;
+        std::vector<float> att_const, att_lin, att_quad;
+        std::vector<float> min_dist, max_dist, att_at_min_dist;
+        std::vector<float> alpha, sharpness, src_rear;
+        std::vector<float> pattern_0, pattern_1, pattern_2;
+        std::vector<uint32_t> voice;
+        std::vector<int> emitter;
+        
+        struct Lane
+        {
+          la::Vec3 pos, vel, fwd;
+          float speed_of_sound;
+          float att_const, att_lin, att_quad;
+          float min_dist, max_dist, att_at_min_dist;
+          float alpha, sharpness, src_rear;
+          float pattern_0, pattern_1, pattern_2;
+          uint32_t voice;
+          int emitter;
+        };
+        
+        template<typename F>
+        void for_each_array(F&& f)
+        {
+          for (auto* arr : { &pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z, &fwd_x, &fwd_y, &fwd_z,
+                             &speed_of_sound, &att_const, &att_lin, &att_quad,
+                             &min_dist, &max_dist, &att_at_min_dist,
+                             &alpha, &sharpness, &src_rear, &pattern_0, &pattern_1, &pattern_2 })
+            f(*arr);
+          f(voice);
+          f(emitter);
+        }
+        
+        // The arrays only ever grow, so that filling them is plain stores.
+        void reserve(size_t n)
+        {
+          if (n > pos_x.size())
+            for_each_array([n](auto& arr) { arr.resize(n); });
+        }
+        void clear() { num_lanes = 0; }
+        size_t size() const { return num_lanes; }
+        
+        void push_back(const Lane& l)
+        {
+          if (num_lanes == pos_x.size())
+            reserve(2 * num_lanes + 16);
+          const size_t i = num_lanes++;
+          pos_x[i] = l.pos.x(); pos_y[i] = l.pos.y(); pos_z[i] = l.pos.z();
+          vel_x[i] = l.vel.x(); vel_y[i] = l.vel.y(); vel_z[i] = l.vel.z();
+          fwd_x[i] = l.fwd.x(); fwd_y[i] = l.fwd.y(); fwd_z[i] = l.fwd.z();
+          speed_of_sound[i] = l.speed_of_sound;
+          att_const[i] = l.att_const; att_lin[i] = l.att_lin; att_quad[i] = l.att_quad;
+          min_dist[i] = l.min_dist; max_dist[i] = l.max_dist; att_at_min_dist[i] = l.att_at_min_dist;
+          alpha[i] = l.alpha; sharpness[i] = l.sharpness; src_rear[i] = l.src_rear;
+          pattern_0[i] = l.pattern_0; pattern_1[i] = l.pattern_1; pattern_2[i] = l.pattern_2;
+          voice[i] = l.voice;
+          emitter[i] = l.emitter;
+        }
+        
+        // Repeats the last lane up to a multiple of width, without changing size().
+        void pad(size_t width)
+        {
+          const size_t n = num_lanes;
+          const size_t n_padded = (n + width - 1) / width * width;
+          reserve(n_padded);
+          for_each_array([n, n_padded](auto& arr) { std::fill(arr.begin() + n, arr.begin() + n_padded, arr[n - 1]); });
+        }
+        
+        size_t num_lanes = 0;
+      };
+      EmitterLanes m_lanes;
     
-      inline constexpr float attenuate(const Source& src, float d)
+      inline constexpr float attenuate(const Source3D& src, float d)
       {
         return 1.f / (src.constant_attenuation + src.linear_attenuation * d + src.quadratic_attenuation * d * d);
       }
       
-      bool reset_attenuation_at_min_dist(Source& src)
+      bool reset_attenuation_at_min_dist(Source3D& src)
       {
         src.attenuation_at_min_dist = attenuate(src, src.min_attenuation_distance);
         
@@ -46,117 +124,148 @@ namespace applaudio
     public:
       PositionalAudio() = default;
       
-      void update_scene(Listener& listener, std::unordered_map<unsigned int, Source>& source_vec)
+      // Scene updates are batched: begin_batch(), add_source() for each 3D voice, then
+      //   end_batch() computes the gains and doppler shifts between each emitter channel and
+      //   each listener channel of all added voices into their slots in params.
+      //   The emitter channels are gathered into one lane each, and end_batch() evaluates
+      //   simd::c_width lanes at a time per listener channel. The directivity and the rear
+      //   muffling use simd::pow(), whose relative error is below 3e-6 here, so gains are
+      //   within 1e-5 of evaluating the formulas with std::pow().
+      void reserve(size_t num_voices)
       {
-        const int n_ch_l = listener.object_3d.num_channels();
+        m_lanes.reserve(num_voices * APL_MAX_CHANNELS + simd::c_width);
+      }
       
-        for (auto& [src_id, src] : source_vec)
+      void begin_batch()
+      {
+        m_lanes.clear();
+      }
+      
+      void add_source(const Source3D& src, ParamTable& params, uint32_t v)
+      {
+        const int n_ch_s = std::min(src.object_3d.num_channels(), APL_MAX_CHANNELS);
+        params.set_num_emitters(v, n_ch_s);
+        for (int ch_s = 0; ch_s < n_ch_s; ++ch_s)
         {
-          const int n_ch_s = src.object_3d.num_channels();
-          for (int ch_s = 0; ch_s < n_ch_s; ++ch_s)
+          const auto* state_s = src.object_3d.get_channel_state(ch_s);
+          const la::Vec3 forward_s = src.object_3d.dir_forward(ch_s);
+          // Pattern as p0 + p1 * cosθ + p2 * |cosθ|.
+          float p0 = 0.f, p1 = 0.f, p2 = 0.f;
+          switch (src.directivity_type)
           {
-            auto* state_s = src.object_3d.get_channel_state(ch_s);
-            state_s->listener_ch_params.resize(n_ch_l);
+            // Classic front-lobe cardioid: D(θ) = 0.5 * (1 + cosθ), ranges [0.5, 1.0].
+            case DirectivityType::Cardioid: p0 = 0.5f; p1 = 0.5f; break;
+            // Tighter front lobe, slight rear lobe: D(θ) = 0.25 + 0.75 * cosθ.
+            case DirectivityType::SuperCardioid: p0 = 0.25f; p1 = 0.75f; break;
+            // max(cosθ, 0).
+            case DirectivityType::HalfRectifiedDipole: p1 = 0.5f; p2 = 0.5f; break;
+            case DirectivityType::Dipole: p2 = 1.f; break;
           }
+          // A huge speed of sound makes the doppler shift exactly 1.
+          const float c = src.speed_of_sound > 0.f ? src.speed_of_sound : 1e30f;
+          m_lanes.push_back({ state_s->pos_world, state_s->vel_world, forward_s, c,
+                              src.constant_attenuation, src.linear_attenuation, src.quadratic_attenuation,
+                              src.min_attenuation_distance, src.max_attenuation_distance, src.attenuation_at_min_dist,
+                              src.directivity_alpha, src.directivity_sharpness, src.rear_attenuation,
+                              p0, p1, p2, v, ch_s });
+        }
+      }
+      
+      void end_batch(const Listener& listener, ParamTable& params)
+      {
+        const size_t num_lanes = m_lanes.size();
+        if (num_lanes == 0)
+          return;
+        // Pad to whole vectors. The padding lanes are evaluated but not written back.
+        m_lanes.pad(simd::c_width);
         
-          for (int ch_l = 0; ch_l < n_ch_l; ++ch_l)
+        using namespace simd;
+        const int n_ch_l = std::min(listener.object_3d.num_channels(), params.num_listener_channels());
+        const vfloat zero = set1(0.f);
+        const vfloat one = set1(1.f);
+        const vfloat half = set1(0.5f);
+        const vfloat min_len_sq = set1(1e-9f);
+        for (int ch_l = 0; ch_l < n_ch_l; ++ch_l)
+        {
+          const auto* state_l = listener.object_3d.get_channel_state(ch_l);
+          const la::Vec3 forward_l = listener.object_3d.dir_forward(ch_l);
+          const la::Vec3 right_l = listener.object_3d.dir_right(ch_l);
+          // Listener pan weight as pw0 + pw1 * pan: left ear, right ear, or none.
+          float pw0 = 1.f, pw1 = 0.f;
+          if (n_ch_l >= 2 && ch_l <= 1)
+          {
+            pw0 = 0.5f;
+            pw1 = ch_l == 0 ? -0.5f : 0.5f;
+          }
+          const vfloat lx = set1(state_l->pos_world.x()), ly = set1(state_l->pos_world.y()), lz = set1(state_l->pos_world.z());
+          const vfloat lvx = set1(state_l->vel_world.x()), lvy = set1(state_l->vel_world.y()), lvz = set1(state_l->vel_world.z());
+          const vfloat lfx = set1(forward_l.x()), lfy = set1(forward_l.y()), lfz = set1(forward_l.z());
+          const vfloat lrx = set1(right_l.x()), lry = set1(right_l.y()), lrz = set1(right_l.z());
+          const vfloat lst_rear = set1(listener.rear_attenuation);
+          
+          for (size_t i = 0; i < num_lanes; i += c_width)
           {
-            const auto* state_l = listener.object_3d.get_channel_state(ch_l);
-            la::Vec3 forward_l = listener.object_3d.dir_forward(ch_l);
-            la::Vec3 right_l   = listener.object_3d.dir_right(ch_l);
-            for (int ch_s = 0; ch_s < n_ch_s; ++ch_s)
+            const auto& L = m_lanes;
+            // dir points FROM listener TO source.
+            const vfloat dx = sub(load(&L.pos_x[i]), lx);
+            const vfloat dy = sub(load(&L.pos_y[i]), ly);
+            const vfloat dz = sub(load(&L.pos_z[i]), lz);
+            const vfloat len_sq = add(add(mul(dx, dx), mul(dy, dy)), mul(dz, dz));
+            // Lanes closer than that keep their previous parameters.
+            const vfloat dist = sqrt(max(len_sq, min_len_sq));
+            const vfloat inv_dist = div(one, dist);
+            const vfloat ux = mul(dx, inv_dist), uy = mul(dy, inv_dist), uz = mul(dz, inv_dist);
+            
+            // Doppler. The velocities along the direction FROM source TO listener.
+            const vfloat vLs = sub(zero, add(add(mul(lvx, ux), mul(lvy, uy)), mul(lvz, uz)));
+            const vfloat vSs = sub(zero, add(add(mul(load(&L.vel_x[i]), ux), mul(load(&L.vel_y[i]), uy)), mul(load(&L.vel_z[i]), uz)));
+            const vfloat c = load(&L.speed_of_sound[i]);
+            const vfloat doppler_shift = clamp(div(add(c, vLs), sub(c, vSs)), set1(0.25f), set1(4.f));
+            
+            // Distance attenuation, flat below the min distance and beyond the max distance.
+            const vfloat d = min(dist, load(&L.max_dist[i]));
+            const vfloat falloff = add(add(load(&L.att_const[i]), mul(load(&L.att_lin[i]), d)), mul(load(&L.att_quad[i]), mul(d, d)));
+            const vfloat distance_gain = select_less(dist, load(&L.min_dist[i]), one,
+                                                     div(one, mul(falloff, load(&L.att_at_min_dist[i]))));
+            
+            // --- Directional Panning (listener ears) ---
+            const vfloat pan = add(add(mul(lrx, ux), mul(lry, uy)), mul(lrz, uz)); // -1=left, +1=right
+            const vfloat listener_pan_weight = add(set1(pw0), mul(set1(pw1), pan));
+            
+            // --- Optional source directivity ---
+            const vfloat src_cos_angle = sub(zero, add(add(mul(load(&L.fwd_x[i]), ux), mul(load(&L.fwd_y[i]), uy)), mul(load(&L.fwd_z[i]), uz)));
+            const vfloat pattern = add(add(load(&L.pattern_0[i]), mul(load(&L.pattern_1[i]), src_cos_angle)),
+                                       mul(load(&L.pattern_2[i]), abs(src_cos_angle)));
+            const vfloat alpha = load(&L.alpha[i]);
+            const vfloat directivity = clamp(add(one, mul(alpha, sub(pattern, one))), zero, one);
+            const vfloat source_directivity_weight = pow(directivity, load(&L.sharpness[i]));
+            
+            // --- Listener front/rear muffling ---
+            const vfloat frontness = add(add(mul(lfx, ux), mul(lfy, uy)), mul(lfz, uz)); // 1 = front, -1 = behind.
+            const vfloat t_rear = clamp(mul(half, add(one, frontness)), zero, one);
+            const vfloat rear_min = mul(load(&L.src_rear[i]), lst_rear);
+            const vfloat rear_weight = add(rear_min, mul(sub(one, rear_min), pow(t_rear, set1(0.7f))));
+            
+            // --- Final gain ---
+            const vfloat gain = clamp(mul(mul(distance_gain, listener_pan_weight), mul(source_directivity_weight, rear_weight)), zero, one);
+            
+            float out_len_sq[c_width], out_gain[c_width], out_doppler[c_width];
+            store(out_len_sq, len_sq);
+            store(out_gain, gain);
+            store(out_doppler, doppler_shift);
+            const size_t n = std::min<size_t>(c_width, num_lanes - i);
+            for (size_t k = 0; k < n; ++k)
             {
-              auto* state_s = src.object_3d.get_channel_state(ch_s);
-              
-              auto dir = state_s->pos_world - state_l->pos_world;
-              if (dir.length_squared() < 1e-9f)
+              if (out_len_sq[k] < 1e-9f)
                 continue;
-              
-              auto dir_un = la::normalize(dir);
-              // dir_un points FROM listener TO source.
-              // But for Doppler, we want the direction FROM source TO listener.
-              la::Vec3 dir_source_to_listener = -dir_un;
-              float vLs = la::dot(state_l->vel_world, dir_source_to_listener); // Listener’s velocity along LOS.
-              float vSs = la::dot(state_s->vel_world, dir_source_to_listener); // Source’s velocity along LOS.
-              
-              const float c = src.speed_of_sound;
-              
-              // Doppler
-              float doppler_shift = 1.f;
-              if (c > 0.f)
-              {
-                doppler_shift = (c + vLs) / (c - vSs);
-                doppler_shift = std::clamp(doppler_shift, 0.25f, 4.f);
-              }
-              
-              // Vector from listener to source
-              float dist = dir.length();
-              if (dist < 1e-6f)
-                dist = 1e-6f;
-              
-              // Distance attenuation
-              float distance_gain = 1.f;
-              if (dist < src.min_attenuation_distance)
-                distance_gain = 1.f;
-              else if (src.min_attenuation_distance <= dist && dist < src.max_attenuation_distance)
-                distance_gain = attenuate(src, dist) / src.attenuation_at_min_dist;
-              else
-                distance_gain = attenuate(src, src.max_attenuation_distance) / src.attenuation_at_min_dist;
-              
-              // --- Directional Panning (listener ears) ---
-              float pan = la::dot(right_l, dir_un); // -1=left, +1=right
-              float listener_pan_weight = 1.f;
-              if (n_ch_l >= 2)
-              {
-                if (ch_l == 0)
-                  listener_pan_weight = 0.5f*(1.0f - pan); // left ear
-                else if (ch_l == 1)
-                  listener_pan_weight = 0.5f*(1.0f + pan); // right ear
-              }
-              
-              // --- Optional source directivity ---
-              la::Vec3 forward_s = src.object_3d.dir_forward(ch_s);
-              float src_cos_angle = la::dot(forward_s, -dir_un);
-              float pattern = 1.f; // Function of cos angle.
-              switch (src.directivity_type)
-              {
-                case DirectivityType::Cardioid:
-                  // Classic front-lobe cardioid: D(θ) = 0.5 * (1 + cosθ).
-                  pattern = 0.5f * (1.0f + src_cos_angle); // ranges [0.5, 1.0].
-                  break;
-                case DirectivityType::SuperCardioid:
-                  // Tighter front lobe, slight rear lobe: D(θ) = 0.25 + 0.75 * cosθ.
-                  pattern = 0.25f + 0.75f * src_cos_angle;
-                  break;
-                case DirectivityType::HalfRectifiedDipole:
-                  pattern = std::max(src_cos_angle, 0.f);
-                  break;
-                case DirectivityType::Dipole:
-                  pattern = std::abs(src_cos_angle);
-                  break;
-              }
-              float source_directivity_weight = std::lerp(1.f, pattern, src.directivity_alpha); // a, b, t.
-              source_directivity_weight = std::pow(std::clamp(source_directivity_weight, 0.f, 1.f),
-                                                   src.directivity_sharpness);
-              
-              // --- Listener front/rear muffling ---
-              float src_rear = src.rear_attenuation;     // 0..1
-              float lst_rear = listener.rear_attenuation; // 0..1
-              float frontness = la::dot(forward_l, dir_un); // 1 = front, -1 = behind.
-              float t_rear = std::clamp(0.5f * (1.0f + frontness), 0.f, 1.f);
-              float rear_weight = std::lerp(src_rear * lst_rear, 1.f, std::pow(t_rear, 0.7f)); // a, b, t.
-              
-              // --- Final gain ---
-              float gain = distance_gain * listener_pan_weight * source_directivity_weight * rear_weight;
-              gain = std::clamp(gain, 0.f, 1.f); // Perhaps better to compress/normalize at mix-level later instead of clamping here.
-              
-              state_s->listener_ch_params[ch_l] = { gain, doppler_shift };
+              params.gains(L.voice[i + k], L.emitter[i + k])[ch_l] = out_gain[k];
+              params.doppler_shifts(L.voice[i + k], L.emitter[i + k])[ch_l] = out_doppler[k];
             }
           }
         }
       }
       
-      bool set_attenuation_min_distance(Source& src, float min_dist)
+      bool set_attenuation_min_distance(Source3D& src, float min_dist)
       {
         assert(std::isfinite(min_dist) && "ERROR: min_dist is not finite.");
         if (!std::isfinite(min_dist))
@@ -170,55 +279,55 @@ namespace applaudio
         return reset_attenuation_at_min_dist(src);
       }
       
-      float get_attenuation_min_distance(const Source& src) const
+      float get_attenuation_min_distance(const Source3D& src) const
       {
         return src.min_attenuation_distance;
       }
       
-      bool set_attenuation_max_distance(Source& src, float max_dist)
+      bool set_attenuation_max_distance(Source3D& src, float max_dist)
       {
         src.max_attenuation_distance = std::max(max_dist, src.min_attenuation_distance);
         
         return reset_attenuation_at_min_dist(src);
       }
       
-      float get_attenuation_max_distance(const Source& src) const
+      float get_attenuation_max_distance(const Source3D& src) const
       {
         return src.max_attenuation_distance;
       }
       
-      bool set_attenuation_constant_falloff(Source& src, float const_falloff)
+      bool set_attenuation_constant_falloff(Source3D& src, float const_falloff)
       {
         src.constant_attenuation = const_falloff;
         
         return reset_attenuation_at_min_dist(src);
       }
       
-      float get_attenuation_constant_falloff(const Source& src) const
+      float get_attenuation_constant_falloff(const Source3D& src) const
       {
         return src.constant_attenuation;
       }
       
-      bool set_attenuation_linear_falloff(Source& src, float lin_falloff)
+      bool set_attenuation_linear_falloff(Source3D& src, float lin_falloff)
       {
         src.linear_attenuation = lin_falloff;
         
         return reset_attenuation_at_min_dist(src);
       }
       
-      float get_attenuation_linear_falloff(const Source& src) const
+      float get_attenuation_linear_falloff(const Source3D& src) const
       {
         return src.linear_attenuation;
       }
       
-      bool set_attenuation_quadratic_falloff(Source& src, float sq_falloff)
+      bool set_attenuation_quadratic_falloff(Source3D& src, float sq_falloff)
       {
         src.quadratic_attenuation = sq_falloff;
         
         return reset_attenuation_at_min_dist(src);
       }
       
-      float get_attenuation_quadratic_falloff(const Source& src) const
+      float get_attenuation_quadratic_falloff(const Source3D& src) const
       {
         return src.quadratic_attenuation;
       }
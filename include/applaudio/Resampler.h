@@ -0,0 +1,486 @@
+//
+//  Resampler.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "defines.h"
+#include "Simd.h"
+#include "AlignedBuffer.h"
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+namespace applaudio
+{
+
+  // Interpolation used when a source is played at a rate other than its buffer's rate
+  //   (sample rate conversion, pitch and doppler). Higher tiers cost more CPU per voice.
+  enum class ResamplerQuality
+  {
+    Linear, // 2 taps. Cheapest. Aliases and dulls high frequencies.
+    Cubic,  // 4 point Catmull-Rom (Hermite) spline.
+    Sinc8,  // 8 tap polyphase windowed sinc.
+    Sinc16, // 16 tap polyphase windowed sinc.
+    Sinc32, // 32 tap polyphase windowed sinc. Use for music.
+  };
+
+  // Stage 1 kernels of the mixer. Each interpolator turns num_frames output frames of interleaved
+  //   source data into planar float scratch rows, row c at scratch + c * stride.
+  //   Interpolators have c_taps taps, c_left of them before the integer position of a frame.
+  //   run() requires all taps of all frames to be inside data. weights() is used for the frames
+  //   near the buffer edges, where resample_voice() fetches the taps one by one.
+  namespace mix_kernels
+  {
+
+    // Channel count template argument meaning "given at runtime".
+    constexpr int c_dyn = 0;
+
+    // Playback positions are 32.32 fixed point frame positions (phase).
+    constexpr int c_phase_frac_bits = 32;
+    constexpr uint64_t c_phase_one = uint64_t(1) << c_phase_frac_bits;
+
+    // Step in source frames per output frame as a phase increment. Negative steps are not supported.
+    inline uint64_t to_phase_step(double step)
+    {
+      return step > 0.0 ? static_cast<uint64_t>(step * static_cast<double>(c_phase_one) + 0.5) : 0;
+    }
+
+    inline size_t phase_index(uint64_t phase) { return static_cast<size_t>(phase >> c_phase_frac_bits); }
+
+    // Top 24 bits of the fraction, which is what a float can hold anyway.
+    //   Goes through a signed conversion since that is the cheap one on every target.
+    inline float phase_frac(uint64_t phase)
+    {
+      return static_cast<float>(static_cast<int32_t>(static_cast<uint32_t>(phase) >> 8)) * (1.f / 16777216.f);
+    }
+
+    // phase * num / den rounded to nearest, e.g. to move a position between two sample rates.
+    //   Exact integer arithmetic for positions below 2^31 frames and rates below 2^18.
+    inline uint64_t rescale_phase(uint64_t phase, uint32_t num, uint32_t den)
+    {
+      const uint64_t a = (phase >> c_phase_frac_bits) * num;
+      const uint64_t frac = (((a % den) << c_phase_frac_bits) + (phase & (c_phase_one - 1)) * num + den / 2) / den;
+      return ((a / den) << c_phase_frac_bits) + frac;
+    }
+
+    // ----- Copy -----
+
+    // Unity step at an integer phase: every output frame is a source frame.
+    template<int SrcCh, typename T>
+    inline void copy_frames(const T* data, int src_ch, uint64_t phase,
+                            int num_frames, float* scratch, size_t stride)
+    {
+      const int channels = SrcCh != c_dyn ? SrcCh : src_ch;
+      const T* src = data + phase_index(phase) * channels;
+      if constexpr (SrcCh == 1)
+        for (int f = 0; f < num_frames; ++f)
+          scratch[f] = static_cast<float>(src[f]);
+      else
+        for (int f = 0; f < num_frames; ++f)
+          for (int c = 0; c < channels; ++c)
+            scratch[c * stride + f] = static_cast<float>(src[f * channels + c]);
+    }
+
+    struct InterpCopy
+    {
+      static constexpr int c_taps = 1;
+      static constexpr int c_left = 0;
+
+      void weights(uint64_t, float* w) const { w[0] = 1.f; }
+
+      // step must be c_phase_one and phase an integer.
+      template<int SrcCh, typename T>
+      void run(const T* data, int src_ch, uint64_t phase, uint64_t,
+               int num_frames, float* scratch, size_t stride) const
+      {
+        copy_frames<SrcCh>(data, src_ch, phase, num_frames, scratch, stride);
+      }
+    };
+
+    // ----- Linear -----
+
+    // Vectorized across output frames, W frames at a time.
+    template<int SrcCh, typename T>
+    inline void resample_linear(const T* data, int src_ch, uint64_t phase, uint64_t step,
+                                int num_frames, float* scratch, size_t stride)
+    {
+      constexpr int W = simd::c_width;
+      const int channels = SrcCh != c_dyn ? SrcCh : src_ch;
+      alignas(64) int32_t offs[W];
+      alignas(64) float fracs[W];
+      alignas(64) float s1[W];
+      alignas(64) float s2[W];
+
+      int f = 0;
+      for (; f + W <= num_frames; f += W)
+      {
+        // Tap offsets are relative to the group's first tap. Integer only, no float to int conversion.
+        const uint64_t p0 = phase + f * step;
+        const size_t base = phase_index(p0);
+        for (int k = 0; k < W; ++k)
+        {
+          const uint64_t p = p0 + k * step;
+          offs[k] = static_cast<int32_t>(phase_index(p) - base);
+          fracs[k] = phase_frac(p);
+        }
+        const auto frac = simd::load(fracs);
+
+        const T* base_ptr = data + base * channels;
+        for (int c = 0; c < channels; ++c)
+        {
+          for (int k = 0; k < W; ++k)
+          {
+            const T* tap = base_ptr + static_cast<size_t>(offs[k]) * channels + c;
+            s1[k] = static_cast<float>(tap[0]);
+            s2[k] = static_cast<float>(tap[channels]);
+          }
+          const auto a = simd::load(s1);
+          const auto b = simd::load(s2);
+          simd::store(scratch + c * stride + f, simd::add(a, simd::mul(frac, simd::sub(b, a))));
+        }
+      }
+
+      for (; f < num_frames; ++f)
+      {
+        const uint64_t p = phase + f * step;
+        const auto frac = phase_frac(p);
+        const T* tap = data + phase_index(p) * channels;
+        for (int c = 0; c < channels; ++c)
+        {
+          const auto a = static_cast<float>(tap[c]);
+          const auto b = static_cast<float>(tap[c + channels]);
+          scratch[c * stride + f] = a + frac * (b - a);
+        }
+      }
+    }
+
+    struct InterpLinear
+    {
+      static constexpr int c_taps = 2;
+      static constexpr int c_left = 0;
+
+      void weights(uint64_t phase, float* w) const
+      {
+        const auto t = phase_frac(phase);
+        w[0] = 1.f - t;
+        w[1] = t;
+      }
+
+      template<int SrcCh, typename T>
+      void run(const T* data, int src_ch, uint64_t phase, uint64_t step,
+               int num_frames, float* scratch, size_t stride) const
+      {
+        resample_linear<SrcCh>(data, src_ch, phase, step, num_frames, scratch, stride);
+      }
+    };
+
+    // ----- Cubic -----
+
+    // Catmull-Rom spline through x[-1], x[0], x[1], x[2], evaluated at t in [0, 1).
+    inline float catmull_rom(float xm1, float x0, float x1, float x2, float t)
+    {
+      return x0 + 0.5f * t * (x1 - xm1 + t * (2.f * xm1 - 5.f * x0 + 4.f * x1 - x2 + t * (3.f * (x0 - x1) + x2 - xm1)));
+    }
+
+    // Vectorized across output frames, like resample_linear().
+    template<int SrcCh, typename T>
+    inline void resample_cubic(const T* data, int src_ch, uint64_t phase, uint64_t step,
+                               int num_frames, float* scratch, size_t stride)
+    {
+      constexpr int W = simd::c_width;
+      const int channels = SrcCh != c_dyn ? SrcCh : src_ch;
+      alignas(64) int32_t offs[W];
+      alignas(64) float fracs[W];
+      alignas(64) float s[4][W];
+
+      const auto half = simd::set1(0.5f);
+      const auto two = simd::set1(2.f);
+      const auto three = simd::set1(3.f);
+      const auto four = simd::set1(4.f);
+      const auto five = simd::set1(5.f);
+
+      int f = 0;
+      for (; f + W <= num_frames; f += W)
+      {
+        const uint64_t p0 = phase + f * step;
+        const size_t base = phase_index(p0);
+        for (int k = 0; k < W; ++k)
+        {
+          const uint64_t p = p0 + k * step;
+          offs[k] = static_cast<int32_t>(phase_index(p) - base);
+          fracs[k] = phase_frac(p);
+        }
+        const auto t = simd::load(fracs);
+
+        const T* base_ptr = data + (base - 1) * channels;
+        for (int c = 0; c < channels; ++c)
+        {
+          for (int k = 0; k < W; ++k)
+          {
+            const T* tap = base_ptr + static_cast<size_t>(offs[k]) * channels + c;
+            for (int j = 0; j < 4; ++j)
+              s[j][k] = static_cast<float>(tap[j * channels]);
+          }
+          const auto xm1 = simd::load(s[0]);
+          const auto x0 = simd::load(s[1]);
+          const auto x1 = simd::load(s[2]);
+          const auto x2 = simd::load(s[3]);
+          auto y = simd::sub(simd::add(simd::mul(three, simd::sub(x0, x1)), x2), xm1);
+          y = simd::add(simd::sub(simd::add(simd::sub(simd::mul(two, xm1), simd::mul(five, x0)), simd::mul(four, x1)), x2), simd::mul(t, y));
+          y = simd::add(simd::sub(x1, xm1), simd::mul(t, y));
+          y = simd::add(x0, simd::mul(simd::mul(half, t), y));
+          simd::store(scratch + c * stride + f, y);
+        }
+      }
+
+      for (; f < num_frames; ++f)
+      {
+        const uint64_t p = phase + f * step;
+        const auto t = phase_frac(p);
+        const T* tap = data + (phase_index(p) - 1) * channels;
+        for (int c = 0; c < channels; ++c)
+          scratch[c * stride + f] = catmull_rom(static_cast<float>(tap[c]),
+                                                static_cast<float>(tap[c + channels]),
+                                                static_cast<float>(tap[c + 2 * channels]),
+                                                static_cast<float>(tap[c + 3 * channels]), t);
+      }
+    }
+
+    struct InterpCubic
+    {
+      static constexpr int c_taps = 4;
+      static constexpr int c_left = 1;
+
+      void weights(uint64_t phase, float* w) const
+      {
+        const auto t = phase_frac(phase);
+        const auto t2 = t * t;
+        const auto t3 = t2 * t;
+        w[0] = 0.5f * (-t + 2.f * t2 - t3);
+        w[1] = 0.5f * (2.f - 5.f * t2 + 3.f * t3);
+        w[2] = 0.5f * (t + 4.f * t2 - 3.f * t3);
+        w[3] = 0.5f * (t3 - t2);
+      }
+
+      template<int SrcCh, typename T>
+      void run(const T* data, int src_ch, uint64_t phase, uint64_t step,
+               int num_frames, float* scratch, size_t stride) const
+      {
+        resample_cubic<SrcCh>(data, src_ch, phase, step, num_frames, scratch, stride);
+      }
+    };
+
+    // ----- Windowed sinc -----
+
+    // Kernel rows are tabulated at c_sinc_phases fractional positions and linearly
+    //   interpolated in between. The row index is taken from the top bits of the phase fraction.
+    constexpr int c_sinc_phase_bits = 8;
+    constexpr int c_sinc_phases = 1 << c_sinc_phase_bits;
+
+    // When a voice steps faster than one source frame per output frame the cutoff must be lowered
+    //   accordingly, or everything above the output Nyquist frequency folds back down.
+    //   Each tap count has one table per band, band b being used for steps up to c_sinc_band_steps[b].
+    //   Steps above the last band alias somewhat, as the filter would otherwise need more taps.
+    constexpr int c_num_sinc_bands = 5;
+    constexpr double c_sinc_band_steps[c_num_sinc_bands] { 1.0, 1.5, 2.0, 3.0, 4.0 };
+
+    struct SincTable
+    {
+      int taps = 0;
+      // c_sinc_phases + 1 rows of taps coefficients. Row p is the kernel for the fraction p / c_sinc_phases.
+      AlignedBuffer<float> coeffs;
+
+      const float* row(int p) const { return coeffs.data() + static_cast<size_t>(p) * taps; }
+    };
+
+    // All sinc tables, shared by all voices.
+    class SincTables
+    {
+    public:
+      static constexpr int c_num_tap_counts = 3;
+      static constexpr int c_tap_counts[c_num_tap_counts] { 8, 16, 32 };
+
+      SincTables()
+      {
+        // Shorter kernels get a wider transition band, so their passband ends earlier.
+        static constexpr double c_passband[c_num_tap_counts] { 0.80, 0.88, 0.94 };
+        static constexpr double c_beta[c_num_tap_counts] { 6.0, 7.5, 9.0 };
+        for (int i = 0; i < c_num_tap_counts; ++i)
+          for (int b = 0; b < c_num_sinc_bands; ++b)
+            build(m_tables[i][b], c_tap_counts[i], c_passband[i] / c_sinc_band_steps[b], c_beta[i]);
+      }
+
+      const SincTable& get(int taps, uint64_t step) const
+      {
+        const int i = taps <= 8 ? 0 : (taps <= 16 ? 1 : 2);
+        int b = 0;
+        while (b + 1 < c_num_sinc_bands && step > to_phase_step(c_sinc_band_steps[b]))
+          ++b;
+        return m_tables[i][b];
+      }
+
+    private:
+      // Zeroth order modified Bessel function of the first kind.
+      static double bessel_i0(double x)
+      {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50 && term > 1e-12 * sum; ++k)
+        {
+          const double a = x / (2.0 * k);
+          term *= a * a;
+          sum += term;
+        }
+        return sum;
+      }
+
+      // Kaiser windowed sinc with the given cutoff (relative to the source Nyquist frequency).
+      //   Each row is normalized to unity DC gain.
+      static void build(SincTable& table, int taps, double cutoff, double beta)
+      {
+        const double pi = 3.14159265358979323846;
+        const int left = taps / 2 - 1;
+        const double half_width = taps / 2.0;
+        const double i0_beta = bessel_i0(beta);
+        table.taps = taps;
+        table.coeffs.resize(static_cast<size_t>(c_sinc_phases + 1) * taps);
+        for (int p = 0; p <= c_sinc_phases; ++p)
+        {
+          const double frac = static_cast<double>(p) / c_sinc_phases;
+          float* row = table.coeffs.data() + static_cast<size_t>(p) * taps;
+          double sum = 0.0;
+          for (int k = 0; k < taps; ++k)
+          {
+            const double x = (k - left) - frac; // Distance from the output position in source frames.
+            const double u = x / half_width;
+            const double window = std::abs(u) < 1.0 ? bessel_i0(beta * std::sqrt(1.0 - u * u)) / i0_beta : 0.0;
+            const double arg = pi * cutoff * x;
+            const double sinc = std::abs(arg) < 1e-9 ? 1.0 : std::sin(arg) / arg;
+            const double h = cutoff * sinc * window;
+            row[k] = static_cast<float>(h);
+            sum += h;
+          }
+          for (int k = 0; k < taps; ++k)
+            row[k] = static_cast<float>(row[k] / sum);
+        }
+      }
+
+      SincTable m_tables[c_num_tap_counts][c_num_sinc_bands];
+    };
+
+    // The tables are built on first use. AudioEngine::startup() calls this so that it
+    //   never happens on the mix thread.
+    inline const SincTables& sinc_tables()
+    {
+      static const SincTables tables;
+      return tables;
+    }
+
+    // Kernel for the fraction of phase, interpolated between the two nearest rows.
+    template<int N>
+    inline void sinc_weights(const SincTable& table, uint64_t phase, float* w)
+    {
+      constexpr int W = simd::c_width;
+      static_assert(N % W == 0);
+      const auto frac32 = static_cast<uint32_t>(phase);
+      const int p = static_cast<int>(frac32 >> (32 - c_sinc_phase_bits));
+      const float t = static_cast<float>(static_cast<int32_t>((frac32 << c_sinc_phase_bits) >> 8)) * (1.f / 16777216.f);
+      const float* r0 = table.row(p);
+      const float* r1 = r0 + N;
+      const auto vt = simd::set1(t);
+      for (int k = 0; k < N; k += W)
+      {
+        const auto a = simd::load(r0 + k);
+        simd::store(w + k, simd::add(a, simd::mul(vt, simd::sub(simd::load(r1 + k), a))));
+      }
+    }
+
+    // Vectorized across the taps of each output frame. Float mono and stereo data are
+    //   loaded directly, interleaved stereo against a kernel with every weight duplicated.
+    template<int N, int SrcCh, typename T>
+    inline void resample_sinc(const SincTable& table, const T* data, int src_ch, uint64_t phase, uint64_t step,
+                              int num_frames, float* scratch, size_t stride)
+    {
+      constexpr int W = simd::c_width;
+      constexpr int c_left = N / 2 - 1;
+      const int channels = SrcCh != c_dyn ? SrcCh : src_ch;
+      alignas(64) float w[N];
+      alignas(64) float lanes[W];
+
+      for (int f = 0; f < num_frames; ++f)
+      {
+        const uint64_t p = phase + f * step;
+        sinc_weights<N>(table, p, w);
+        const T* tap = data + (phase_index(p) - c_left) * channels;
+
+        if constexpr (std::is_same_v<T, float> && SrcCh == 1)
+        {
+          auto acc = simd::mul(simd::load(w), simd::load(tap));
+          for (int k = W; k < N; k += W)
+            acc = simd::add(acc, simd::mul(simd::load(w + k), simd::load(tap + k)));
+          simd::store(lanes, acc);
+          float sum = 0.f;
+          for (int k = 0; k < W; ++k)
+            sum += lanes[k];
+          scratch[f] = sum;
+        }
+        else if constexpr (std::is_same_v<T, float> && SrcCh == 2)
+        {
+          auto acc = simd::set1(0.f);
+          for (int k = 0; k < N; k += W)
+          {
+            simd::vfloat w_lo, w_hi;
+            const auto wk = simd::load(w + k);
+            simd::interleave(wk, wk, w_lo, w_hi);
+            acc = simd::add(acc, simd::mul(w_lo, simd::load(tap + 2 * k)));
+            acc = simd::add(acc, simd::mul(w_hi, simd::load(tap + 2 * k + W)));
+          }
+          simd::store(lanes, acc);
+          float sum_l = 0.f;
+          float sum_r = 0.f;
+          for (int k = 0; k < W; k += 2)
+          {
+            sum_l += lanes[k];
+            sum_r += lanes[k + 1];
+          }
+          scratch[f] = sum_l;
+          scratch[stride + f] = sum_r;
+        }
+        else
+        {
+          for (int c = 0; c < channels; ++c)
+          {
+            float sum = 0.f;
+            for (int k = 0; k < N; ++k)
+              sum += w[k] * static_cast<float>(tap[k * channels + c]);
+            scratch[c * stride + f] = sum;
+          }
+        }
+      }
+    }
+
+    template<int N>
+    struct InterpSinc
+    {
+      static constexpr int c_taps = N;
+      static constexpr int c_left = N / 2 - 1;
+      const SincTable& table;
+
+      void weights(uint64_t phase, float* w) const { sinc_weights<N>(table, phase, w); }
+
+      template<int SrcCh, typename T>
+      void run(const T* data, int src_ch, uint64_t phase, uint64_t step,
+               int num_frames, float* scratch, size_t stride) const
+      {
+        resample_sinc<N, SrcCh>(table, data, src_ch, phase, step, num_frames, scratch, stride);
+      }
+    };
+
+  }
+
+}
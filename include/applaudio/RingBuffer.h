@@ -0,0 +1,119 @@
+//
+//  RingBuffer.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  // Wait-free single-producer / single-consumer ring of interleaved frames.
+  // Capacity is a power of two (in frames) so wrapping is a mask rather than a modulo.
+  // Positions grow monotonically and transfers are done as at most two memcpy segments.
+  template<typename T>
+  class RingBuffer
+  {
+    std::vector<T> m_data;
+    size_t m_mask = 0;
+    size_t m_channels = 1;
+
+    alignas(64) std::atomic<size_t> m_write_pos { 0 };
+    alignas(64) std::atomic<size_t> m_read_pos { 0 };
+
+  public:
+    RingBuffer() = default;
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // Not thread safe. min_frames is rounded up to the nearest power of two.
+    void reset(size_t min_frames, size_t channels)
+    {
+      size_t cap = 1;
+      while (cap < min_frames)
+        cap <<= 1;
+      m_channels = std::max<size_t>(channels, 1);
+      m_data.assign(cap * m_channels, static_cast<T>(0));
+      m_mask = cap - 1;
+      m_write_pos.store(0, std::memory_order_relaxed);
+      m_read_pos.store(0, std::memory_order_relaxed);
+    }
+
+    size_t capacity_frames() const { return m_data.empty() ? 0 : m_mask + 1; }
+
+    // Frames ready to be read. Exact on the consumer side, a lower bound elsewhere.
+    size_t available_read() const
+    {
+      return m_write_pos.load(std::memory_order_acquire) - m_read_pos.load(std::memory_order_acquire);
+    }
+
+    // Free frames. Exact on the producer side, a lower bound elsewhere.
+    size_t available_write() const
+    {
+      return capacity_frames() - available_read();
+    }
+
+    // Producer only. Returns the number of frames actually written.
+    size_t write(const T* data, size_t frames)
+    {
+      const size_t w = m_write_pos.load(std::memory_order_relaxed);
+      const size_t r = m_read_pos.load(std::memory_order_acquire);
+      frames = std::min(frames, capacity_frames() - (w - r));
+      if (frames == 0)
+        return 0;
+
+      const size_t start = w & m_mask;
+      const size_t first = std::min(frames, m_mask + 1 - start);
+      std::memcpy(&m_data[start * m_channels], data, first * m_channels * sizeof(T));
+      if (frames > first)
+        std::memcpy(m_data.data(), data + first * m_channels, (frames - first) * m_channels * sizeof(T));
+
+      m_write_pos.store(w + frames, std::memory_order_release);
+      return frames;
+    }
+
+    // Consumer only. Returns the number of frames actually read.
+    size_t read(T* data, size_t frames)
+    {
+      const size_t r = m_read_pos.load(std::memory_order_relaxed);
+      const size_t w = m_write_pos.load(std::memory_order_acquire);
+      frames = std::min(frames, w - r);
+      if (frames == 0)
+        return 0;
+
+      const size_t start = r & m_mask;
+      const size_t first = std::min(frames, m_mask + 1 - start);
+      std::memcpy(data, &m_data[start * m_channels], first * m_channels * sizeof(T));
+      if (frames > first)
+        std::memcpy(data + first * m_channels, m_data.data(), (frames - first) * m_channels * sizeof(T));
+
+      m_read_pos.store(r + frames, std::memory_order_release);
+      return frames;
+    }
+
+    // Consumer only. Zero-copy access to the next contiguous readable segment.
+    //   Returns the number of frames in the segment (at most max_frames). Follow up with consume().
+    size_t peek(const T*& data, size_t max_frames) const
+    {
+      const size_t r = m_read_pos.load(std::memory_order_relaxed);
+      const size_t w = m_write_pos.load(std::memory_order_acquire);
+      const size_t start = r & m_mask;
+      data = m_data.data() + start * m_channels;
+      return std::min({ max_frames, w - r, m_mask + 1 - start });
+    }
+
+    // Consumer only.
+    void consume(size_t frames)
+    {
+      m_read_pos.store(m_read_pos.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+    }
+  };
+
+}
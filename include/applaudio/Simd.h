@@ -0,0 +1,258 @@
+//
+//  Simd.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+
+// Instruction set is picked at compile time. Define APL_NO_SIMD to force the scalar fallback.
+#if !defined(APL_NO_SIMD) && defined(__AVX2__)
+#define APL_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(APL_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define APL_SIMD_SSE2
+#include <emmintrin.h>
+#elif !defined(APL_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define APL_SIMD_NEON
+#include <arm_neon.h>
+#else
+#define APL_SIMD_SCALAR
+#endif
+
+namespace applaudio
+{
+
+  // Minimal float vector wrapper used by the mix kernels and the 3D scene update.
+  //   All loads and stores are unaligned.
+  namespace simd
+  {
+
+#if defined(APL_SIMD_AVX2)
+    constexpr int c_width = 8;
+    struct vfloat { __m256 v; };
+
+    inline vfloat set1(float x) { return { _mm256_set1_ps(x) }; }
+    inline vfloat load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    inline void store(float* p, vfloat a) { _mm256_storeu_ps(p, a.v); }
+    inline vfloat add(vfloat a, vfloat b) { return { _mm256_add_ps(a.v, b.v) }; }
+    inline vfloat sub(vfloat a, vfloat b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    inline vfloat mul(vfloat a, vfloat b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    inline vfloat div(vfloat a, vfloat b) { return { _mm256_div_ps(a.v, b.v) }; }
+    inline vfloat min(vfloat a, vfloat b) { return { _mm256_min_ps(a.v, b.v) }; }
+    inline vfloat max(vfloat a, vfloat b) { return { _mm256_max_ps(a.v, b.v) }; }
+    inline vfloat ramp() { return { _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f) }; }
+    inline vfloat sqrt(vfloat a) { return { _mm256_sqrt_ps(a.v) }; }
+    // Per lane a < b ? x : y.
+    inline vfloat select_less(vfloat a, vfloat b, vfloat x, vfloat y) { return { _mm256_blendv_ps(y.v, x.v, _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)) }; }
+    // x = 2^e * m with m in [1, 2), for normal x > 0.
+    inline void split_exponent(vfloat x, vfloat& e, vfloat& m)
+    {
+      __m256i bits = _mm256_castps_si256(x.v);
+      e.v = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+      m.v = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000)));
+    }
+    // 2^n for integral n in [-126, 127].
+    inline vfloat pow2i(vfloat n) { return { _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(n.v), _mm256_set1_epi32(127)), 23)) }; }
+    // Rounds towards zero.
+    inline vfloat trunc(vfloat a) { return { _mm256_cvtepi32_ps(_mm256_cvttps_epi32(a.v)) }; }
+    inline void store_trunc(int32_t* p, vfloat a) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), _mm256_cvttps_epi32(a.v)); }
+    // lo = a0 b0 a1 b1 a2 b2 a3 b3, hi = a4 b4 ... a7 b7.
+    inline void interleave(vfloat a, vfloat b, vfloat& lo, vfloat& hi)
+    {
+      __m256 l = _mm256_unpacklo_ps(a.v, b.v);
+      __m256 h = _mm256_unpackhi_ps(a.v, b.v);
+      lo.v = _mm256_permute2f128_ps(l, h, 0x20);
+      hi.v = _mm256_permute2f128_ps(l, h, 0x31);
+    }
+#elif defined(APL_SIMD_SSE2)
+    constexpr int c_width = 4;
+    struct vfloat { __m128 v; };
+
+    inline vfloat set1(float x) { return { _mm_set1_ps(x) }; }
+    inline vfloat load(const float* p) { return { _mm_loadu_ps(p) }; }
+    inline void store(float* p, vfloat a) { _mm_storeu_ps(p, a.v); }
+    inline vfloat add(vfloat a, vfloat b) { return { _mm_add_ps(a.v, b.v) }; }
+    inline vfloat sub(vfloat a, vfloat b) { return { _mm_sub_ps(a.v, b.v) }; }
+    inline vfloat mul(vfloat a, vfloat b) { return { _mm_mul_ps(a.v, b.v) }; }
+    inline vfloat div(vfloat a, vfloat b) { return { _mm_div_ps(a.v, b.v) }; }
+    inline vfloat min(vfloat a, vfloat b) { return { _mm_min_ps(a.v, b.v) }; }
+    inline vfloat max(vfloat a, vfloat b) { return { _mm_max_ps(a.v, b.v) }; }
+    inline vfloat ramp() { return { _mm_setr_ps(0.f, 1.f, 2.f, 3.f) }; }
+    inline vfloat sqrt(vfloat a) { return { _mm_sqrt_ps(a.v) }; }
+    inline vfloat select_less(vfloat a, vfloat b, vfloat x, vfloat y)
+    {
+      __m128 m = _mm_cmplt_ps(a.v, b.v);
+      return { _mm_or_ps(_mm_and_ps(m, x.v), _mm_andnot_ps(m, y.v)) };
+    }
+    inline void split_exponent(vfloat x, vfloat& e, vfloat& m)
+    {
+      __m128i bits = _mm_castps_si128(x.v);
+      e.v = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+      m.v = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000)));
+    }
+    inline vfloat pow2i(vfloat n) { return { _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(n.v), _mm_set1_epi32(127)), 23)) }; }
+    inline vfloat trunc(vfloat a) { return { _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v)) }; }
+    inline void store_trunc(int32_t* p, vfloat a) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm_cvttps_epi32(a.v)); }
+    inline void interleave(vfloat a, vfloat b, vfloat& lo, vfloat& hi)
+    {
+      lo.v = _mm_unpacklo_ps(a.v, b.v);
+      hi.v = _mm_unpackhi_ps(a.v, b.v);
+    }
+#elif defined(APL_SIMD_NEON)
+    constexpr int c_width = 4;
+    struct vfloat { float32x4_t v; };
+
+    inline vfloat set1(float x) { return { vdupq_n_f32(x) }; }
+    inline vfloat load(const float* p) { return { vld1q_f32(p) }; }
+    inline void store(float* p, vfloat a) { vst1q_f32(p, a.v); }
+    inline vfloat add(vfloat a, vfloat b) { return { vaddq_f32(a.v, b.v) }; }
+    inline vfloat sub(vfloat a, vfloat b) { return { vsubq_f32(a.v, b.v) }; }
+    inline vfloat mul(vfloat a, vfloat b) { return { vmulq_f32(a.v, b.v) }; }
+#if defined(__aarch64__) || defined(_M_ARM64)
+    inline vfloat div(vfloat a, vfloat b) { return { vdivq_f32(a.v, b.v) }; }
+#else
+    // No vector divide on 32 bit ARM. Reciprocal estimate with two Newton-Raphson steps.
+    inline vfloat div(vfloat a, vfloat b)
+    {
+      float32x4_t r = vrecpeq_f32(b.v);
+      r = vmulq_f32(vrecpsq_f32(b.v, r), r);
+      r = vmulq_f32(vrecpsq_f32(b.v, r), r);
+      return { vmulq_f32(a.v, r) };
+    }
+#endif
+    inline vfloat min(vfloat a, vfloat b) { return { vminq_f32(a.v, b.v) }; }
+    inline vfloat max(vfloat a, vfloat b) { return { vmaxq_f32(a.v, b.v) }; }
+    inline vfloat ramp() { static const float r[4] { 0.f, 1.f, 2.f, 3.f }; return { vld1q_f32(r) }; }
+#if defined(__aarch64__) || defined(_M_ARM64)
+    inline vfloat sqrt(vfloat a) { return { vsqrtq_f32(a.v) }; }
+#else
+    // Reciprocal square root estimate with two Newton-Raphson steps. 0 stays 0.
+    inline vfloat sqrt(vfloat a)
+    {
+      float32x4_t r = vrsqrteq_f32(a.v);
+      r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a.v, r), r), r);
+      r = vmulq_f32(vrsqrtsq_f32(vmulq_f32(a.v, r), r), r);
+      return { vbslq_f32(vceqq_f32(a.v, vdupq_n_f32(0.f)), a.v, vmulq_f32(a.v, r)) };
+    }
+#endif
+    inline vfloat select_less(vfloat a, vfloat b, vfloat x, vfloat y) { return { vbslq_f32(vcltq_f32(a.v, b.v), x.v, y.v) }; }
+    inline void split_exponent(vfloat x, vfloat& e, vfloat& m)
+    {
+      uint32x4_t bits = vreinterpretq_u32_f32(x.v);
+      e.v = vcvtq_f32_s32(vsubq_s32(vreinterpretq_s32_u32(vshrq_n_u32(bits, 23)), vdupq_n_s32(127)));
+      m.v = vreinterpretq_f32_u32(vorrq_u32(vandq_u32(bits, vdupq_n_u32(0x007FFFFF)), vdupq_n_u32(0x3F800000)));
+    }
+    inline vfloat pow2i(vfloat n) { return { vreinterpretq_f32_s32(vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n.v), vdupq_n_s32(127)), 23)) }; }
+    inline vfloat trunc(vfloat a) { return { vcvtq_f32_s32(vcvtq_s32_f32(a.v)) }; }
+    inline void store_trunc(int32_t* p, vfloat a) { vst1q_s32(p, vcvtq_s32_f32(a.v)); }
+    inline void interleave(vfloat a, vfloat b, vfloat& lo, vfloat& hi)
+    {
+      float32x4x2_t z = vzipq_f32(a.v, b.v);
+      lo.v = z.val[0];
+      hi.v = z.val[1];
+    }
+#else
+    constexpr int c_width = 4;
+    struct vfloat { float v[4]; };
+
+    inline vfloat set1(float x) { return { { x, x, x, x } }; }
+    inline vfloat load(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+    inline void store(float* p, vfloat a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+    inline vfloat add(vfloat a, vfloat b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+    inline vfloat sub(vfloat a, vfloat b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+    inline vfloat mul(vfloat a, vfloat b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+    inline vfloat div(vfloat a, vfloat b) { for (int i = 0; i < 4; ++i) a.v[i] /= b.v[i]; return a; }
+    inline vfloat min(vfloat a, vfloat b) { for (int i = 0; i < 4; ++i) a.v[i] = b.v[i] < a.v[i] ? b.v[i] : a.v[i]; return a; }
+    inline vfloat max(vfloat a, vfloat b) { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] < b.v[i] ? b.v[i] : a.v[i]; return a; }
+    inline vfloat ramp() { return { { 0.f, 1.f, 2.f, 3.f } }; }
+    inline vfloat sqrt(vfloat a) { for (int i = 0; i < 4; ++i) a.v[i] = std::sqrt(a.v[i]); return a; }
+    inline vfloat select_less(vfloat a, vfloat b, vfloat x, vfloat y) { for (int i = 0; i < 4; ++i) x.v[i] = a.v[i] < b.v[i] ? x.v[i] : y.v[i]; return x; }
+    inline void split_exponent(vfloat x, vfloat& e, vfloat& m)
+    {
+      for (int i = 0; i < 4; ++i)
+      {
+        uint32_t bits = 0;
+        std::memcpy(&bits, &x.v[i], sizeof(bits));
+        e.v[i] = static_cast<float>(static_cast<int32_t>(bits >> 23) - 127);
+        bits = (bits & 0x007FFFFF) | 0x3F800000;
+        std::memcpy(&m.v[i], &bits, sizeof(bits));
+      }
+    }
+    inline vfloat pow2i(vfloat n)
+    {
+      for (int i = 0; i < 4; ++i)
+      {
+        uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(n.v[i]) + 127) << 23;
+        std::memcpy(&n.v[i], &bits, sizeof(bits));
+      }
+      return n;
+    }
+    inline vfloat trunc(vfloat a) { for (int i = 0; i < 4; ++i) a.v[i] = std::trunc(a.v[i]); return a; }
+    inline void store_trunc(int32_t* p, vfloat a) { for (int i = 0; i < 4; ++i) p[i] = static_cast<int32_t>(a.v[i]); }
+    inline void interleave(vfloat a, vfloat b, vfloat& lo, vfloat& hi)
+    {
+      lo = { { a.v[0], b.v[0], a.v[1], b.v[1] } };
+      hi = { { a.v[2], b.v[2], a.v[3], b.v[3] } };
+    }
+#endif
+
+    inline vfloat clamp(vfloat a, vfloat lo, vfloat hi) { return min(max(a, lo), hi); }
+    inline vfloat abs(vfloat a) { return max(a, sub(set1(0.f), a)); }
+    
+    // Fast log2 for normal x > 0. log2(m) for the mantissa m in [1, 2) comes from the series
+    //   log2(m) = 2 / ln(2) * (t + t^3/3 + t^5/5 + ...) with t = (m - 1) / (m + 1) in [0, 1/3),
+    //   cut after t^13. Absolute error below 2e-7 * (1 + |log2(x)|).
+    inline vfloat log2(vfloat x)
+    {
+      vfloat e, m;
+      split_exponent(x, e, m);
+      const vfloat one = set1(1.f);
+      const vfloat t = div(sub(m, one), add(m, one));
+      const vfloat t2 = mul(t, t);
+      vfloat p = set1(1.f / 13.f);
+      p = add(mul(p, t2), set1(1.f / 11.f));
+      p = add(mul(p, t2), set1(1.f / 9.f));
+      p = add(mul(p, t2), set1(1.f / 7.f));
+      p = add(mul(p, t2), set1(1.f / 5.f));
+      p = add(mul(p, t2), set1(1.f / 3.f));
+      p = add(mul(p, t2), one);
+      return add(e, mul(set1(2.f / 0.69314718f), mul(p, t)));
+    }
+    
+    // Fast 2^y, y clamped to [-126, 127]. 2^y = 2^n * e^(f ln(2)) with n the nearest integer
+    //   and |f| <= 1/2, the latter from its Taylor series up to f^7. Relative error below 2e-7.
+    inline vfloat exp2(vfloat y)
+    {
+      y = clamp(y, set1(-126.f), set1(127.f));
+      const vfloat half = set1(0.5f);
+      const vfloat n = trunc(add(y, select_less(y, set1(0.f), sub(set1(0.f), half), half)));
+      const vfloat f = mul(sub(y, n), set1(0.69314718f));
+      vfloat p = set1(1.f / 5040.f);
+      p = add(mul(p, f), set1(1.f / 720.f));
+      p = add(mul(p, f), set1(1.f / 120.f));
+      p = add(mul(p, f), set1(1.f / 24.f));
+      p = add(mul(p, f), set1(1.f / 6.f));
+      p = add(mul(p, f), half);
+      p = add(mul(p, f), set1(1.f));
+      p = add(mul(p, f), set1(1.f));
+      return mul(p, pow2i(n));
+    }
+    
+    // Fast x^y for x >= 0 and y > 0. 0 for x below the smallest normal float.
+    //   Relative error below 2e-7 * (1 + y + |y * log2(x)|) where the result is a normal float,
+    //   e.g. below 2.6e-6 for x in [1e-6, 1] and y <= 0.7, vs about 6e-8 for std::pow().
+    inline vfloat pow(vfloat x, vfloat y)
+    {
+      const vfloat min_normal = set1(1.17549435e-38f);
+      const vfloat r = exp2(mul(y, log2(max(x, min_normal))));
+      return select_less(x, min_normal, set1(0.f), r);
+    }
+
+  }
+
+}
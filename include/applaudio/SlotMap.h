@@ -0,0 +1,148 @@
+//
+//  SlotMap.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  // Contiguous storage addressed by generational 32 bit handles. A handle holds the slot
+  //   index + 1 in its low c_index_bits bits, so 0 is never a valid handle, and the slot's
+  //   generation in the remaining bits. Erasing bumps the generation, which makes find()
+  //   reject stale handles in O(1) instead of returning a newer value in the same slot.
+  //   Freed slots are reused oldest first, so that churn is spread over all free slots, and a
+  //   slot whose generation would wrap, after 2^(32 - c_index_bits) reuses, is retired instead.
+  template<typename T>
+  class SlotMap
+  {
+  public:
+    static constexpr int c_index_bits = 20;
+    static constexpr uint32_t c_index_mask = (uint32_t(1) << c_index_bits) - 1;
+    static constexpr uint32_t c_generation_mask = (uint32_t(1) << (32 - c_index_bits)) - 1;
+    static constexpr uint32_t c_max_slots = c_index_mask - 1;
+
+    static uint32_t index_of(uint32_t handle) { return (handle & c_index_mask) - 1; } // Wraps for handle 0.
+    static uint32_t generation_of(uint32_t handle) { return handle >> c_index_bits; }
+    static uint32_t make_handle(uint32_t index, uint32_t generation) { return (generation << c_index_bits) | (index + 1); }
+    static constexpr uint32_t c_no_slot = ~uint32_t(0);
+
+    // Preallocates storage for num_slots slots. insert() and emplace_at() below that many
+    //   slots, and erase(), don't allocate. Retired slots count towards num_slots.
+    void reserve(size_t num_slots)
+    {
+      m_slots.reserve(num_slots);
+    }
+
+    // Returns the new value's handle, or 0 if all c_max_slots slots are taken.
+    uint32_t insert(T value)
+    {
+      uint32_t index = 0;
+      if (m_free_head != c_no_slot)
+      {
+        index = m_free_head;
+        m_free_head = m_slots[index].next_free;
+        if (m_free_head == c_no_slot)
+          m_free_tail = c_no_slot;
+      }
+      else if (m_slots.size() < c_max_slots)
+      {
+        index = static_cast<uint32_t>(m_slots.size());
+        m_slots.emplace_back();
+      }
+      else
+        return 0;
+      auto& slot = m_slots[index];
+      slot.value = std::move(value);
+      slot.occupied = true;
+      ++m_size;
+      return make_handle(index, slot.generation);
+    }
+
+    // Puts value under a handle made by another SlotMap, so that two maps can share handles.
+    //   The slot must be free. A map filled this way doesn't keep a free list, so don't mix
+    //   emplace_at() and insert() on the same map.
+    void emplace_at(uint32_t handle, T value)
+    {
+      m_mirror = true;
+      const uint32_t index = index_of(handle);
+      if (index >= m_slots.size())
+        m_slots.resize(index + 1);
+      auto& slot = m_slots[index];
+      slot.value = std::move(value);
+      slot.generation = generation_of(handle);
+      slot.occupied = true;
+      ++m_size;
+    }
+
+    // Returns false if the handle is stale.
+    bool erase(uint32_t handle)
+    {
+      if (find(handle) == nullptr)
+        return false;
+      const uint32_t index = index_of(handle);
+      auto& slot = m_slots[index];
+      slot.value = T {};
+      slot.occupied = false;
+      slot.generation = (slot.generation + 1) & c_generation_mask;
+      // Appended to the free list, unless the generation wrapped, as the slot's first handle would be valid again.
+      if (!m_mirror && slot.generation != 0)
+      {
+        slot.next_free = c_no_slot;
+        if (m_free_tail == c_no_slot)
+          m_free_head = index;
+        else
+          m_slots[m_free_tail].next_free = index;
+        m_free_tail = index;
+      }
+      --m_size;
+      return true;
+    }
+
+    T* find(uint32_t handle)
+    {
+      const uint32_t index = index_of(handle);
+      if (index >= m_slots.size())
+        return nullptr;
+      auto& slot = m_slots[index];
+      return slot.occupied && slot.generation == generation_of(handle) ? &slot.value : nullptr;
+    }
+
+    const T* find(uint32_t handle) const
+    {
+      return const_cast<SlotMap*>(this)->find(handle);
+    }
+
+    // Calls f(handle, value) for every value, in slot order.
+    template<typename F>
+    void for_each(F&& f)
+    {
+      for (uint32_t index = 0; index < m_slots.size(); ++index)
+        if (m_slots[index].occupied)
+          f(make_handle(index, m_slots[index].generation), m_slots[index].value);
+    }
+
+    size_t size() const { return m_size; }
+
+  private:
+    struct Slot
+    {
+      T value {};
+      uint32_t generation = 0;
+      uint32_t next_free = c_no_slot;
+      bool occupied = false;
+    };
+    std::vector<Slot> m_slots;
+    uint32_t m_free_head = c_no_slot; // Free list, linked through Slot::next_free.
+    uint32_t m_free_tail = c_no_slot;
+    size_t m_size = 0;
+    bool m_mirror = false;
+  };
+
+}
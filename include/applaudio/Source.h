@@ -7,24 +7,25 @@
 
 #pragma once
 #include "Object3D.h"
+#include "Resampler.h"
+#include <atomic>
+#include <cstdint>
 
 namespace applaudio
 {
 
   enum class DirectivityType { Cardioid, SuperCardioid, HalfRectifiedDipole, Dipole };
+  
+  // Shared between the API and the mix thread.
+  //   The mix thread publishes the play id of a playback that ran to its end.
+  struct SourceStatus
+  {
+    std::atomic<unsigned int> finished_play_id { 0 };
+  };
 
-  struct Source
+  // Configuration only read by the 3D scene update and by 3D voices.
+  struct Source3D
   {
-    unsigned int buffer_id = 0;
-    bool looping = false;
-    float gain = 1.0f;
-    float vol_gain = 1.0f;
-    float pitch = 1.0f;
-    bool playing = false;
-    bool paused = false;
-    double play_pos = 0;
-    std::optional<float> pan = std::nullopt;
-    
     a3d::Object3D object_3d;
     
     float speed_of_sound = 0.f;
@@ -40,6 +41,27 @@ namespace applaudio
     float directivity_sharpness = 1.f; // [1, 8].
     DirectivityType directivity_type = DirectivityType::Cardioid;
     float rear_attenuation = 1.f; // [0, 1].
+    
+    float audible_radius = 0.f; // Virtual beyond this distance from the listener. 0: no limit.
+    bool clusterable = false; // May be merged with nearby sources playing the same buffer.
+  };
+
+  // API side state of a source. The mix thread keeps the fields read while mixing in a
+  //   VoiceTable and the rest as a Source3D.
+  struct Source : Source3D
+  {
+    unsigned int buffer_id = 0;
+    bool looping = false;
+    float gain = 1.0f;
+    float vol_gain = 1.0f;
+    float pitch = 1.0f;
+    bool playing = false;
+    bool paused = false;
+    float priority = 1.f; // Scales the audibility that decides which voices are mixed when over the voice limit.
+    std::optional<float> pan = std::nullopt;
+    std::optional<ResamplerQuality> resampler_quality = std::nullopt; // nullopt: the engine default.
+    unsigned int play_id = 0; // Incremented for every play_source() call.
+    SourceStatus* status = nullptr;
   };
 
 }
@@ -0,0 +1,283 @@
+//
+//  SpatialGrid.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "LinAlg.h"
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  namespace a3d
+  {
+
+    // Uniform hash grid of spheres, indexed by item (voice slot). An item is listed in every
+    //   cell its sphere overlaps, so a query only visits the cells around the query point.
+    //   Spheres spanning more than c_max_cells_per_item cells are kept in a separate list that
+    //   every query visits. Cells are hashed into a fixed number of buckets, and the entries
+    //   come from a pool, so moving items around doesn't allocate once reserve() was called.
+    class SpatialGrid
+    {
+    public:
+      static constexpr int c_max_cells_per_item = 8;
+
+      // Preallocates storage for num_items items with spheres spanning up to c_max_cells_per_item cells.
+      void reserve(size_t num_items)
+      {
+        init_buckets(num_items);
+        m_entries.reserve(num_items * c_max_cells_per_item);
+        m_free_entries.reserve(num_items * c_max_cells_per_item);
+        grow_items(num_items);
+      }
+
+      // Cells should be at least twice the typical sphere radius. Changing it re-indexes all items.
+      void set_cell_size(float cell_size)
+      {
+        if (!(cell_size > 0.f) || cell_size == m_cell_size)
+          return;
+        m_cell_size = cell_size;
+        for (uint32_t item = 0; item < m_items.size(); ++item)
+          if (m_items[item].listed)
+          {
+            auto& it = m_items[item];
+            unlink(item);
+            link(item, it.center, it.radius);
+          }
+      }
+      float get_cell_size() const { return m_cell_size; }
+
+      // Inserts the item or moves it. Only re-links it if the range of cells it overlaps changed.
+      void update(uint32_t item, const la::Vec3& center, float radius)
+      {
+        grow_items(item + 1);
+        auto& it = m_items[item];
+        if (it.listed && calc_cell_range(center, radius) == it.cells)
+        {
+          it.center = center;
+          it.radius = radius;
+          return;
+        }
+        if (it.listed)
+          unlink(item);
+        link(item, center, radius);
+      }
+
+      void remove(uint32_t item)
+      {
+        if (contains(item))
+          unlink(item);
+      }
+
+      bool contains(uint32_t item) const { return item < m_items.size() && m_items[item].listed; }
+      // True if the item is listed and was reported by the last query().
+      bool hit_by_last_query(uint32_t item) const { return contains(item) && m_items[item].hit == m_query_stamp; }
+      size_t size() const { return m_num_items; }
+
+      // Calls f(item) once for every item whose sphere reaches within extent of center.
+      template<typename F>
+      void query(const la::Vec3& center, float extent, F&& f)
+      {
+        ++m_query_stamp;
+        if (m_num_items == 0)
+          return;
+        auto visit = [&](uint32_t head)
+        {
+          for (uint32_t e = head; e != c_none; e = m_entries[e].next)
+          {
+            const uint32_t item = m_entries[e].item;
+            auto& it = m_items[item];
+            if (it.stamp == m_query_stamp)
+              continue;
+            it.stamp = m_query_stamp;
+            const float reach = it.radius + extent;
+            if ((it.center - center).length_squared() <= reach * reach)
+            {
+              it.hit = m_query_stamp;
+              f(item);
+            }
+          }
+        };
+        visit(m_large_head);
+        // A query spanning more cells than there are buckets visits each bucket once instead.
+        const auto range = calc_cell_range(center, extent);
+        if (count_cells(range, m_buckets.size()) > m_buckets.size())
+        {
+          for (auto head : m_buckets)
+            visit(head);
+          return;
+        }
+        for (int32_t z = range[2]; z <= range[5]; ++z)
+          for (int32_t y = range[1]; y <= range[4]; ++y)
+            for (int32_t x = range[0]; x <= range[3]; ++x)
+              visit(m_buckets[bucket_of(x, y, z)]);
+      }
+
+    private:
+      static constexpr uint32_t c_none = ~uint32_t(0);
+
+      using CellRange = std::array<int32_t, 6>; // Min x, y, z, max x, y, z.
+
+      struct Item
+      {
+        la::Vec3 center;
+        float radius = 0.f;
+        CellRange cells {};
+        uint32_t first_entry = c_none; // Chained through Entry::next_of_item.
+        uint32_t stamp = 0; // Last query that visited it.
+        uint32_t hit = 0; // Last query that reported it.
+        bool listed = false;
+      };
+
+      // An item's membership in one bucket, doubly linked so it can be unlinked in O(1).
+      struct Entry
+      {
+        uint32_t item = 0;
+        uint32_t bucket = 0; // c_none for the list of large items.
+        uint32_t prev = c_none;
+        uint32_t next = c_none;
+        uint32_t next_of_item = c_none;
+      };
+
+      CellRange calc_cell_range(const la::Vec3& center, float radius) const
+      {
+        auto cell = [this](float x) { return static_cast<int32_t>(std::floor(std::clamp(x / m_cell_size, -1e9f, 1e9f))); };
+        return { cell(center.x() - radius), cell(center.y() - radius), cell(center.z() - radius),
+                 cell(center.x() + radius), cell(center.y() + radius), cell(center.z() + radius) };
+      }
+
+      // Number of cells in r, or limit + 1 if there are more. Spans are checked one at a time,
+      //   as the product of three spans of up to 2e9 cells each would overflow.
+      static size_t count_cells(const CellRange& r, size_t limit)
+      {
+        size_t num_cells = 1;
+        for (int a = 0; a < 3; ++a)
+        {
+          const auto span = static_cast<size_t>(int64_t(r[a + 3]) - r[a] + 1);
+          if (span > limit || num_cells * span > limit)
+            return limit + 1;
+          num_cells *= span;
+        }
+        return num_cells;
+      }
+
+      uint32_t bucket_of(int32_t x, int32_t y, int32_t z) const
+      {
+        const uint32_t h = static_cast<uint32_t>(x) * 73856093u ^ static_cast<uint32_t>(y) * 19349663u ^ static_cast<uint32_t>(z) * 83492791u;
+        return h & (static_cast<uint32_t>(m_buckets.size()) - 1);
+      }
+
+      void init_buckets(size_t num_items)
+      {
+        size_t num_buckets = 64;
+        while (num_buckets < 2 * num_items)
+          num_buckets *= 2;
+        if (num_buckets <= m_buckets.size())
+          return;
+        // Re-link everything into the new buckets.
+        std::vector<uint32_t> listed;
+        for (uint32_t item = 0; item < m_items.size(); ++item)
+          if (m_items[item].listed)
+          {
+            listed.emplace_back(item);
+            unlink(item);
+          }
+        m_buckets.assign(num_buckets, c_none);
+        for (auto item : listed)
+          link(item, m_items[item].center, m_items[item].radius);
+      }
+
+      void grow_items(size_t num_items)
+      {
+        if (m_items.size() < num_items)
+          m_items.resize(num_items);
+      }
+
+      uint32_t alloc_entry()
+      {
+        if (!m_free_entries.empty())
+        {
+          const uint32_t e = m_free_entries.back();
+          m_free_entries.pop_back();
+          return e;
+        }
+        m_entries.emplace_back();
+        return static_cast<uint32_t>(m_entries.size() - 1);
+      }
+
+      uint32_t& head_of(uint32_t bucket) { return bucket == c_none ? m_large_head : m_buckets[bucket]; }
+
+      void push_entry(uint32_t item, uint32_t bucket)
+      {
+        const uint32_t e = alloc_entry();
+        auto& head = head_of(bucket);
+        m_entries[e] = { item, bucket, c_none, head, m_items[item].first_entry };
+        if (head != c_none)
+          m_entries[head].prev = e;
+        head = e;
+        m_items[item].first_entry = e;
+      }
+
+      void link(uint32_t item, const la::Vec3& center, float radius)
+      {
+        if (m_buckets.empty())
+          init_buckets(0);
+        auto& it = m_items[item];
+        it.center = center;
+        it.radius = radius;
+        it.cells = calc_cell_range(center, radius);
+        it.first_entry = c_none;
+        it.listed = true;
+        ++m_num_items;
+        const auto& r = it.cells;
+        if (count_cells(r, c_max_cells_per_item) > c_max_cells_per_item)
+        {
+          push_entry(item, c_none);
+          return;
+        }
+        for (int32_t z = r[2]; z <= r[5]; ++z)
+          for (int32_t y = r[1]; y <= r[4]; ++y)
+            for (int32_t x = r[0]; x <= r[3]; ++x)
+              push_entry(item, bucket_of(x, y, z));
+      }
+
+      void unlink(uint32_t item)
+      {
+        auto& it = m_items[item];
+        for (uint32_t e = it.first_entry; e != c_none; e = m_entries[e].next_of_item)
+        {
+          const auto& entry = m_entries[e];
+          if (entry.prev != c_none)
+            m_entries[entry.prev].next = entry.next;
+          else
+            head_of(entry.bucket) = entry.next;
+          if (entry.next != c_none)
+            m_entries[entry.next].prev = entry.prev;
+          m_free_entries.emplace_back(e);
+        }
+        it.first_entry = c_none;
+        it.listed = false;
+        --m_num_items;
+      }
+
+      float m_cell_size = 64.f;
+      std::vector<Item> m_items;
+      std::vector<Entry> m_entries;
+      std::vector<uint32_t> m_free_entries;
+      std::vector<uint32_t> m_buckets; // Head entry of each bucket.
+      uint32_t m_large_head = c_none;
+      size_t m_num_items = 0;
+      uint32_t m_query_stamp = 0;
+    };
+
+  }
+
+}
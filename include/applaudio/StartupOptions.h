@@ -0,0 +1,54 @@
+//
+//  StartupOptions.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <cstddef>
+
+namespace applaudio
+{
+
+  // Optional tuning passed to AudioEngine::startup().
+  //   Backends silently ignore the settings they don't support.
+  struct StartupOptions
+  {
+    // Let the device clock pace the mixing if the backend supports it (see IBackend::set_render_callback()).
+    //   If false, the engine pushes data from its own timer thread via the backend's software ring.
+    bool pull_mode = true;
+    
+    // Number of threads mixing voices, including the audio thread. 0 means one per hardware thread.
+    //   Mixing only goes parallel for blocks with at least parallel_mix_min_voices playing voices.
+    //   The output is bit identical regardless of the number of threads.
+    int num_mix_threads = 1;
+    int parallel_mix_min_voices = 64;
+    
+    // Storage for this many sources and buffers is reserved at startup. As long as there are
+    //   no more than that, the mix thread doesn't touch the heap.
+    int max_sources = 256;
+    int max_buffers = 256;
+    
+    // 3D sources with an audible radius are indexed in a uniform grid with cells of this size,
+    //   in the length unit of the 3D scene. Works best at about twice the typical radius.
+    float spatial_grid_cell_size = 64.f;
+    
+    // Buffers whose sample rate differs from the output rate are converted to the output rate
+    //   once, with the best resampler, as long as the copies fit in this many bytes in total.
+    //   Sources at unity pitch and without doppler then play the copy without interpolation.
+    //   0 disables the cache.
+    size_t resample_cache_budget_bytes = 0;
+    
+    // ALSA: Requested period size in frames and number of periods in the device buffer.
+    //   The device may adjust both. 0 means backend default (1024 frames x 2 periods).
+    //   Output latency is roughly period_size_frames * num_periods / sample rate.
+    int period_size_frames = 0;
+    int num_periods = 0;
+    
+    // ALSA: Mix directly into the device buffer (SND_PCM_ACCESS_MMAP_INTERLEAVED).
+    //   Falls back to regular read/write access if the device refuses mmap.
+    bool use_mmap = false;
+  };
+
+}
@@ -0,0 +1,136 @@
+//
+//  VoiceTable.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include "Source.h"
+#include "Resampler.h"
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+namespace applaudio
+{
+
+  // How much effort goes into mixing a 3D voice, see AudioEngine::set_3d_lod_thresholds().
+  enum class LodTier : uint8_t
+  {
+    Full,    // As configured.
+    Reduced, // Resampler quality at most Cubic, source channels mixed down to mono before the panning.
+    Minimal, // Linear resampling, source channels mixed down to mono before the panning.
+  };
+
+  // Mix side state of all voices, one array per field, indexed by the slot index of the
+  //   source's id (SlotMap::index_of()). These are the fields the mix loop reads every block,
+  //   so walking many voices streams a few bytes per voice rather than whole Source structs.
+  struct VoiceTable
+  {
+    enum Flags : uint16_t
+    {
+      Playing = 1 << 0,
+      Looping = 1 << 1,
+      Panned = 1 << 2,
+      Resampled = 1 << 3, // play_phase counts frames of Buffer::resampled rather than Buffer::data.
+      Virtualized = 1 << 4, // Not mixed in the last block, only its position advanced.
+      InPlayList = 1 << 5, // Listed in AudioEngine::m_mix_playing.
+      Using3D = 1 << 6, // Mirrors Source3D::object_3d.using_3d_audio().
+      Dirty3D = 1 << 7, // The Source3D changed since its parameters in the ParamTable were computed.
+      OutOfRange = 1 << 8, // Farther from the listener than Source3D::audible_radius, hence virtual.
+      HasLastGains = 1 << 9, // last_gains holds the gains the voice was last mixed with.
+      HasLastStep = 1 << 10, // last_step holds the step the voice was last mixed with.
+      Clusterable = 1 << 11, // Mirrors Source3D::clusterable.
+      Clustered = 1 << 12, // Merged into the voice leading its cluster, hence virtual.
+      ClusterLeader = 1 << 13, // Mixed for its whole cluster, at its centroid and with cluster_gain.
+    };
+    static constexpr int8_t c_default_quality = -1; // The engine's resampler quality.
+    static constexpr size_t c_max_gains = APL_MAX_CHANNELS * APL_MAX_CHANNELS;
+    
+    std::vector<unsigned int> handle; // Id of the source in the slot, 0 if none.
+    std::vector<uint16_t> flags;
+    std::vector<uint64_t> play_phase; // 32.32 fixed point position in frames.
+    std::vector<float> gain;
+    std::vector<float> vol_gain;
+    std::vector<float> pitch;
+    std::vector<float> pan; // Read if Panned.
+    std::vector<float> priority;
+    std::vector<unsigned int> buffer_id;
+    std::vector<int8_t> quality; // ResamplerQuality or c_default_quality.
+    std::vector<unsigned int> play_id;
+    std::vector<SourceStatus*> status;
+    std::vector<LodTier> lod;
+    std::vector<float> cluster_gain; // Read if ClusterLeader. Replaces gain * vol_gain.
+    std::vector<uint32_t> stale_3d; // Full 3D updates that deferred the voice since it went Dirty3D.
+    // What the last block was mixed with, which the next block ramps from.
+    std::vector<uint64_t> last_step;
+    std::vector<float> last_gains; // c_max_gains per voice, dst_ch x src_ch, row major.
+    
+    // Preallocates num_voices slots. reset() below that doesn't allocate.
+    void reserve(size_t num_voices)
+    {
+      for_each_array([num_voices](auto& arr) { arr.reserve(num_voices); });
+      last_gains.reserve(num_voices * c_max_gains);
+    }
+    
+    // Puts a new source in slot v with default settings.
+    void reset(uint32_t v, unsigned int src_id, SourceStatus* src_status)
+    {
+      if (v >= handle.size())
+      {
+        for_each_array([v](auto& arr) { arr.resize(v + 1); });
+        last_gains.resize((v + 1) * c_max_gains);
+      }
+      handle[v] = src_id;
+      flags[v] = 0;
+      play_phase[v] = 0;
+      gain[v] = 1.f;
+      vol_gain[v] = 1.f;
+      pitch[v] = 1.f;
+      pan[v] = 0.f;
+      priority[v] = 1.f;
+      buffer_id[v] = 0;
+      quality[v] = c_default_quality;
+      play_id[v] = 0;
+      status[v] = src_status;
+      lod[v] = LodTier::Full;
+      cluster_gain[v] = 1.f;
+      stale_3d[v] = 0;
+      last_step[v] = 0;
+    }
+    
+    // True if src_id still refers to the source in its slot.
+    bool valid(uint32_t v, unsigned int src_id) const { return v < handle.size() && handle[v] == src_id; }
+    
+    bool has(uint32_t v, Flags flag) const { return (flags[v] & flag) != 0; }
+    void set(uint32_t v, Flags flag, bool on)
+    {
+      flags[v] = on ? (flags[v] | flag) : (flags[v] & ~flag);
+    }
+    
+    float* last_gains_of(uint32_t v) { return last_gains.data() + v * c_max_gains; }
+    
+    // The quality the voice is resampled with, lowered by its LodTier.
+    ResamplerQuality get_quality(uint32_t v, ResamplerQuality engine_quality) const
+    {
+      const auto q = quality[v] == c_default_quality ? engine_quality : static_cast<ResamplerQuality>(quality[v]);
+      switch (lod[v])
+      {
+        case LodTier::Reduced: return std::min(q, ResamplerQuality::Cubic);
+        case LodTier::Minimal: return ResamplerQuality::Linear;
+        default: return q;
+      }
+    }
+    
+  private:
+    template<typename F>
+    void for_each_array(F&& f)
+    {
+      f(handle); f(flags); f(play_phase); f(gain); f(vol_gain); f(pitch); f(pan);
+      f(priority); f(buffer_id); f(quality); f(play_id); f(status); f(lod); f(cluster_gain); f(stale_3d); f(last_step);
+    }
+  };
+
+}
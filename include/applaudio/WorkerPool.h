@@ -0,0 +1,113 @@
+//
+//  WorkerPool.h
+//  applaudio
+//
+//  Created by Rasmus Anthin on 2026-10-16.
+//
+
+#pragma once
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <type_traits>
+#include <cstdint>
+
+namespace applaudio
+{
+
+  // Small fork-join pool for the audio thread.
+  // run() hands out task indices to the workers and the calling thread alike and
+  //   returns once every task is done. Workers sleep on an atomic between runs,
+  //   so neither side takes a lock. Tasks also get the index of the thread they run on
+  //   (0 = the calling thread), which lets them use per thread scratch memory.
+  class WorkerPool
+  {
+    std::vector<std::thread> m_threads;
+
+    void (*m_task_fn)(void*, int, int) = nullptr;
+    void* m_task_ctx = nullptr;
+    int m_num_tasks = 0;
+
+    std::atomic<uint64_t> m_generation { 0 };
+    std::atomic<int> m_next_task { 0 };
+    std::atomic<int> m_workers_done { 0 };
+    std::atomic<bool> m_quit { false };
+
+    void work(int thread_idx)
+    {
+      for (int i = m_next_task.fetch_add(1, std::memory_order_relaxed); i < m_num_tasks;
+           i = m_next_task.fetch_add(1, std::memory_order_relaxed))
+        m_task_fn(m_task_ctx, i, thread_idx);
+    }
+
+    // seen is the generation at start(), so that runs from before a restart aren't picked up.
+    void worker_loop(int thread_idx, uint64_t seen)
+    {
+      for (;;)
+      {
+        m_generation.wait(seen, std::memory_order_acquire);
+        seen = m_generation.load(std::memory_order_acquire);
+        if (m_quit.load(std::memory_order_relaxed))
+          return;
+        work(thread_idx);
+        m_workers_done.fetch_add(1, std::memory_order_release);
+      }
+    }
+
+  public:
+    WorkerPool() = default;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool() { stop(); }
+
+    // num_workers excludes the thread calling run().
+    void start(int num_workers)
+    {
+      stop();
+      m_quit = false;
+      const uint64_t generation = m_generation.load(std::memory_order_acquire);
+      for (int w = 0; w < num_workers; ++w)
+        m_threads.emplace_back(&WorkerPool::worker_loop, this, w + 1, generation);
+    }
+
+    void stop()
+    {
+      if (m_threads.empty())
+        return;
+      m_quit.store(true, std::memory_order_relaxed);
+      m_generation.fetch_add(1, std::memory_order_release);
+      m_generation.notify_all();
+      for (auto& t : m_threads)
+        t.join();
+      m_threads.clear();
+    }
+
+    // Including the calling thread.
+    int num_threads() const { return static_cast<int>(m_threads.size()) + 1; }
+
+    // Calls task(i, thread_idx) for i in [0, num_tasks), with thread_idx in [0, num_threads()).
+    //   Tasks may run in any order and on any thread.
+    template<typename Func>
+    void run(int num_tasks, Func&& task)
+    {
+      using F = std::remove_reference_t<Func>;
+      m_task_fn = [](void* ctx, int i, int thread_idx) { (*static_cast<F*>(ctx))(i, thread_idx); };
+      m_task_ctx = const_cast<void*>(static_cast<const void*>(&task));
+      m_num_tasks = num_tasks;
+      m_next_task.store(0, std::memory_order_relaxed);
+      m_workers_done.store(0, std::memory_order_relaxed);
+
+      m_generation.fetch_add(1, std::memory_order_release);
+      m_generation.notify_all();
+
+      work(0);
+
+      // Every worker checks in once per run, so no worker can still be
+      //   looking at the task members when the next run overwrites them.
+      const int num_workers = static_cast<int>(m_threads.size());
+      while (m_workers_done.load(std::memory_order_acquire) < num_workers)
+        std::this_thread::yield();
+    }
+  };
+
+}
@@ -14,6 +14,10 @@
 #define APL_SHORT_MIN_L static_cast<long>(APL_SHORT_MIN)
 #define APL_SHORT_MAX_L static_cast<long>(APL_SHORT_MAX)
 
+// Max number of channels of a buffer or the listener.
+//   Per channel state is stored inline up to this count, so the mix thread never has to allocate for it.
+#define APL_MAX_CHANNELS 8
+
 // comment out to get 16bit internal format.
 #define APL_32
 #ifdef APL_32 // float (32 bit)